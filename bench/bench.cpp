@@ -0,0 +1,187 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#include "bench/harness.hpp"
+#include "io/csvreader.hpp"
+#include "linalg/linalg.hpp"
+#include "nn/perceptron.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+/*
+	Benchmarks of the hot paths: matrix products, per-sample training passes, CSV parsing
+	and model files. Usage:
+		perceptron_bench [--filter <text>] [--json <file>] [--repeats <n>] [--warmup <n>] [--min-time <seconds>] [--isa <name>|all]
+	--isa runs the kernel cases with the given instruction set (generic, sse4.2, avx2, avx512, avx512vnni),
+	"all" runs them once per supported set with the set's name appended to case names.
+*/
+using LA = LinearAlgebra<float>;
+using Perceptron = NN::TPerceptron<float, NN::Activation::Sigmoid>;
+
+namespace {
+	// deterministic pseudo-random contents, the values themselves do not matter
+	void Fill(float *data, size_t n, uint32_t seed) {
+		for (size_t i = 0; i < n; ++i) {
+			seed = seed*1664525u + 1013904223u;
+			data[i] = float(seed >> 8)/float(1 << 24) - 0.5f;
+		}
+	}
+	size_t Parameters(const std::vector<size_t> &topology) {
+		size_t res = 0;
+		for (size_t i = 0; i + 1 < topology.size(); ++i) {
+			res += topology[i]*topology[i + 1] + topology[i + 1];
+		}
+		return res;
+	}
+	std::string Name(const std::vector<size_t> &topology) {
+		std::string res;
+		for (size_t n: topology) {
+			res += (res.empty() ? "" : "-") + std::to_string(n);
+		}
+		return res;
+	}
+
+	void Gemm(Bench::Suite &suite, const std::string &suffix) {
+		const size_t shapes[][3] = {{1, 512, 784}, {1, 10, 16}, {16, 512, 784}, {64, 256, 512}, {128, 128, 128}, {256, 256, 256}, {512, 512, 512}};
+		for (const auto &s: shapes) {
+			const std::string name = "linalg/gemm/" + std::to_string(s[0]) + "x" + std::to_string(s[1]) + "x" + std::to_string(s[2]) + suffix;
+			if (!suite.Selected(name)) {
+				continue;
+			}
+			LA::Matrix a(s[0], s[2]);
+			LA::Matrix b(s[2], s[1]);
+			Fill(a.Data(), s[0]*s[2], 1);
+			Fill(b.Data(), s[2]*s[1], 2);
+			LA::Matrix c = a*b;
+			LinAlg::Autotuner::Instance().Wait(); // the shape is tuned before it is timed
+			suite.Run(name, 2.*s[0]*s[1]*s[2], "FLOP", [&]() {
+				c = a*b;
+				Bench::DoNotOptimize(c);
+			});
+		}
+	}
+
+	void Passes(Bench::Suite &suite, const std::string &suffix) {
+		const std::vector<std::vector<size_t>> topologies = {{784, 128, 10}, {784, 512, 256, 128, 64, 16, 10}, {64, 64, 64, 64}};
+		for (const std::vector<size_t> &topology: topologies) {
+			Perceptron net(0.001);
+			net.BuildTopology(topology);
+			net.Init(1);
+			Perceptron::Sample sample(topology.front(), topology.back());
+			Fill(sample.input.data(), sample.input.size(), 3);
+			sample.output[0] = 1;
+			const double params = Parameters(topology);
+			suite.Run("nn/feedForward/" + Name(topology) + suffix, 2.*params, "FLOP", [&]() {
+				Bench::DoNotOptimize(net.feedForward(sample.input));
+			});
+			net.feedForward(sample.input);
+			// error propagation and the rank-1 update, activations stay from the pass above
+			suite.Run("nn/backpropagation/" + Name(topology) + suffix, 4.*params, "FLOP", [&]() {
+				net.backpropagation(sample.output);
+			});
+		}
+	}
+
+	void Csv(Bench::Suite &suite) {
+		const size_t ROWS = 2000;
+		const size_t FIELDS = 785; // MNIST row: label and 784 pixels
+		const std::string filename = (std::filesystem::temp_directory_path()/"perceptron_bench.csv").string();
+		{
+			std::ofstream f(filename);
+			uint32_t seed = 4;
+			f << "label";
+			for (size_t i = 1; i < FIELDS; ++i) {
+				f << ",pixel" << i;
+			}
+			f << "\n";
+			for (size_t r = 0; r < ROWS; ++r) {
+				for (size_t i = 0; i < FIELDS; ++i) {
+					seed = seed*1664525u + 1013904223u;
+					f << ((0 == i) ? "" : ",") << ((i > 0) && (seed & 0x100) ? 0 : (seed >> 24));
+				}
+				f << "\n";
+			}
+		}
+		const double bytes = std::filesystem::file_size(filename);
+		std::vector<int> row(FIELDS);
+		suite.Run("io/csv/parse_mapped", bytes, "B", [&]() {
+			IO::CSVReader csv;
+			std::vector<std::string_view> header;
+			csv.OpenMapped(filename);
+			csv.ReadRow(header, ',');
+			size_t count = 0;
+			while (IO::CSVReader::Status::End != csv.ParseRow(row.data(), row.size(), count, ',')) {
+				Bench::DoNotOptimize(row);
+			}
+		});
+		suite.Run("io/csv/read_stream", bytes, "B", [&]() {
+			IO::CSVReader csv;
+			std::vector<std::string> fields;
+			csv.Open(filename);
+			while (csv.ReadRow(fields, ',')) {
+				Bench::DoNotOptimize(fields);
+			}
+		});
+		std::remove(filename.c_str());
+	}
+
+	void Model(Bench::Suite &suite) {
+		const std::vector<size_t> topology = {784, 512, 256, 128, 64, 16, 10};
+		const std::string filename = (std::filesystem::temp_directory_path()/"perceptron_bench.nn").string();
+		Perceptron net(0.001);
+		net.BuildTopology(topology);
+		net.Init(1);
+		net.SaveToFile(filename);
+		const double bytes = std::filesystem::file_size(filename);
+		const Perceptron::Vector input(topology.front(), 0.5f);
+		suite.Run("nn/model/save/" + Name(topology), bytes, "B", [&]() {
+			net.SaveToFile(filename);
+		});
+		suite.Run("nn/model/load/" + Name(topology), bytes, "B", [&]() {
+			Perceptron loaded(0.001);
+			loaded.LoadFromFile(filename);
+			Bench::DoNotOptimize(loaded);
+		});
+		// the first prediction takes the page faults a mapped model defers
+		suite.Run("nn/model/map_predict/" + Name(topology), bytes, "B", [&]() {
+			Perceptron mapped(0.001);
+			mapped.MapFromFile(filename);
+			Bench::DoNotOptimize(mapped.Predict(input));
+		});
+		std::remove(filename.c_str());
+	}
+}
+
+int main(int argc, char *argv[]) {
+	Bench::Options options;
+	if (!Bench::Options::Parse(argc, argv, options)) {
+		std::cerr << "usage: " << argv[0] << " [--filter <text>] [--json <file>] [--repeats <n>] [--warmup <n>] [--min-time <seconds>] [--isa <name>|all]" << std::endl;
+		return 1;
+	}
+	std::vector<LinAlg::Isa> isas(1, LinAlg::ActiveIsa());
+	if ("all" == options.isa) {
+		isas.clear();
+		for (size_t i = 0; i <= size_t(LinAlg::SupportedIsa()); ++i) {
+			isas.push_back(LinAlg::Isa(i));
+		}
+	} else if (!options.isa.empty() && (!LinAlg::ParseIsa(options.isa.c_str(), isas[0]) || !LinAlg::SelectIsa(isas[0]))) {
+		std::cerr << "instruction set " << options.isa << " is not supported" << std::endl;
+		return 1;
+	}
+	std::cout << "kernels: " << LinAlg::IsaName(LinAlg::ActiveIsa()) << " (supported " << LinAlg::IsaName(LinAlg::SupportedIsa()) << ")" << std::endl;
+	Bench::Suite suite(options);
+	for (LinAlg::Isa isa: isas) {
+		const std::string suffix = (isas.size() > 1) ? ("/" + std::string(LinAlg::IsaName(isa))) : "";
+		LinAlg::SelectIsa(isa);
+		Gemm(suite, suffix);
+		Passes(suite, suffix);
+	}
+	Csv(suite);
+	Model(suite);
+	if (!suite.WriteJson()) {
+		std::cerr << "can't write " << options.json << std::endl;
+		return 1;
+	}
+	return 0;
+}
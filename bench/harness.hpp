@@ -0,0 +1,170 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef BENCH_HARNESS_HPP
+#define BENCH_HARNESS_HPP
+
+#include "linalg/threadpool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+	Minimal benchmark harness: every case is warmed up, then timed run by run until it
+	has at least Options::repeats runs and Options::minTime seconds in total. Statistics
+	of run times (min, mean, percentiles) and the throughput at the median go to the
+	console and, if requested, to a JSON file for tracking between releases.
+*/
+namespace Bench {
+	// keeps the compiler from dropping a computation whose result is not used
+	template <class T> inline void DoNotOptimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "g"(&value) : "memory");
+#else
+		static volatile const void *sink;
+		sink = &value;
+#endif
+	}
+
+	struct Options {
+		std::string filter; // only cases whose name contains it
+		std::string json; // file for results
+		size_t warmup = 3;
+		size_t repeats = 20;
+		size_t maxRepeats = 10000;
+		double minTime = 0.2; // seconds per case
+		std::string isa; // instruction set of kernels (linalg/isa.hpp) or "all" of the supported ones
+
+		// --filter <text> --json <file> --repeats <n> --warmup <n> --min-time <seconds> --isa <name>
+		static bool Parse(int argc, char *argv[], Options &options) {
+			bool res = true;
+			for (int i = 1; res && (i < argc); ++i) {
+				const std::string arg = argv[i];
+				res = (i + 1 < argc);
+				if (!res) {
+					break;
+				}
+				const char *value = argv[++i];
+				if ("--filter" == arg) {
+					options.filter = value;
+				} else if ("--json" == arg) {
+					options.json = value;
+				} else if ("--repeats" == arg) {
+					options.repeats = std::max(1l, std::atol(value));
+				} else if ("--warmup" == arg) {
+					options.warmup = std::max(0l, std::atol(value));
+				} else if ("--min-time" == arg) {
+					options.minTime = std::atof(value);
+				} else if ("--isa" == arg) {
+					options.isa = value;
+				} else {
+					res = false;
+				}
+			}
+			return res;
+		}
+	};
+
+	struct Result {
+		std::string name;
+		std::string unit; // of work, e.g. FLOP or B
+		double work; // per run
+		size_t runs;
+		double min;
+		double mean;
+		double p50;
+		double p90;
+		double p99;
+		double max;
+	};
+
+	class Suite {
+		public:
+			Suite(const Options &options)
+				: _options(options) {
+			}
+			bool Selected(const std::string &name) const {
+				return _options.filter.empty() || (std::string::npos != name.find(_options.filter));
+			}
+			// times f(), work is the amount of unit done by one call
+			template <class FUNCTION> void Run(const std::string &name, double work, const std::string &unit, FUNCTION &&f) {
+				using Clock = std::chrono::steady_clock;
+				if (!Selected(name)) {
+					return;
+				}
+				for (size_t i = 0; i < _options.warmup; ++i) {
+					f();
+				}
+				std::vector<double> times;
+				double total = 0;
+				while ((times.size() < _options.repeats) || ((total < _options.minTime) && (times.size() < _options.maxRepeats))) {
+					auto start = Clock::now();
+					f();
+					const double t = std::chrono::duration<double>(Clock::now() - start).count();
+					times.push_back(t);
+					total += t;
+				}
+				std::sort(times.begin(), times.end());
+				Result r = {name, unit, work, times.size(), times.front(), total/times.size(), _percentile(times, 50), _percentile(times, 90), _percentile(times, 99), times.back()};
+				_print(r);
+				_results.push_back(r);
+			}
+			const std::vector<Result> &Results() const {
+				return _results;
+			}
+			bool WriteJson() const {
+				bool res = false;
+				do {
+					if (_options.json.empty()) {
+						res = true;
+						break;
+					}
+					std::ofstream f(_options.json);
+					if (!f.is_open()) {
+						break;
+					}
+					f << std::setprecision(9);
+					f << "{\n\t\"suite\": \"perceptron_bench\",\n\t\"threads\": " << _threads() << ",\n\t\"results\": [";
+					for (size_t i = 0; i < _results.size(); ++i) {
+						const Result &r = _results[i];
+						f << ((0 == i) ? "\n" : ",\n");
+						f << "\t\t{\"name\": \"" << r.name << "\", \"runs\": " << r.runs << ", \"unit\": \"" << r.unit << "\", \"work\": " << r.work;
+						f << ", \"seconds\": {\"min\": " << r.min << ", \"mean\": " << r.mean << ", \"p50\": " << r.p50 << ", \"p90\": " << r.p90 << ", \"p99\": " << r.p99 << ", \"max\": " << r.max << "}";
+						f << ", \"throughput\": " << r.work/r.p50 << "}";
+					}
+					f << "\n\t]\n}\n";
+					res = static_cast<bool>(f);
+				} while (false);
+				return res;
+			}
+
+		private:
+			// nearest-rank percentile of sorted values
+			static double _percentile(const std::vector<double> &sorted, size_t p) {
+				const size_t rank = (p*sorted.size() + 99)/100;
+				return sorted[std::max<size_t>(rank, 1) - 1];
+			}
+			static size_t _threads() {
+				return LinAlg::ThreadPool::Instance().Threads();
+			}
+			static void _print(const Result &r) {
+				std::cout << std::left << std::setw(48) << r.name << std::right << std::fixed << std::setprecision(3)
+					<< " p50 " << std::setw(10) << r.p50*1e6 << " us"
+					<< "  p90 " << std::setw(10) << r.p90*1e6 << " us"
+					<< "  p99 " << std::setw(10) << r.p99*1e6 << " us"
+					<< "  " << std::setw(10) << r.work/r.p50*1e-9 << " G" << r.unit << "/s"
+					<< "  (" << r.runs << " runs)" << std::endl;
+				std::cout.unsetf(std::ios::floatfield);
+			}
+
+			Options _options;
+			std::vector<Result> _results;
+	};
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef IO_CHECKSUM_HPP
+#define IO_CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace IO {
+	static constexpr uint64_t CHECKSUM_SEED = 0xCBF29CE484222325ull;
+
+	// 64-bit FNV-1a style checksum taken by 8-byte words, the tail is taken byte by byte.
+	// Checksums of consecutive chunks are chained by passing the previous one as seed.
+	// It detects truncated and damaged files, it is not a cryptographic hash.
+	inline uint64_t Checksum(const void *data, size_t size, uint64_t seed = CHECKSUM_SEED) {
+		const uint64_t PRIME = 0x100000001B3ull;
+		const uint8_t *p = static_cast<const uint8_t *>(data);
+		uint64_t h = seed;
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+			uint64_t w;
+			std::memcpy(&w, p + i, sizeof(w));
+			h = (h ^ w)*PRIME;
+			h ^= h >> 32;
+		}
+		for (; i < size; ++i) {
+			h = (h ^ p[i])*PRIME;
+		}
+		return h;
+	}
+}
+
+#endif
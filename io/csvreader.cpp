@@ -2,25 +2,53 @@
 	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
 */
 #include "io/csvreader.hpp"
+#include <cstring>
 #include <sstream>
 
 namespace IO {
-	CSVReader::CSVReader() {
+	CSVReader::CSVReader()
+		: _cursor(nullptr)
+		, _end(nullptr)
+		, _row(0)
+		, _error({0, 0, ErrorCode::None}) {
 	}
 	bool CSVReader::Open(const std::string &filename) {
 		ifs.open(filename, std::ios::in);
 		bool res = ifs.is_open();
 		return res;
 	}
+	bool CSVReader::OpenMapped(const std::string &filename) {
+		bool res = false;
+		do {
+			if (!_file.Open(filename)) {
+				break;
+			}
+			_cursor = reinterpret_cast<const char *>(_file.Data());
+			_end = _cursor + _file.Size();
+			_row = 0;
+			res = true;
+		} while (false);
+		return res;
+	}
 	void CSVReader::Close() {
 		ifs.close();
+		_file.Close();
+		_cursor = nullptr;
+		_end = nullptr;
 	}
 	bool CSVReader::ReadRow(std::vector<std::string> &row, char splitter) {
 		std::string line;
 		bool res = false;
 		do {
 			row.clear();
-			if (!std::getline(ifs, line)) {
+			if (_file.IsOpen()) {
+				const char *begin = nullptr;
+				const char *end = nullptr;
+				if (!_nextLine(begin, end)) {
+					break;
+				}
+				line.assign(begin, end);
+			} else if (!std::getline(ifs, line)) {
 				break;
 			}
 			res = true;
@@ -32,4 +60,47 @@ namespace IO {
 		} while (false);
 		return res;
 	}
+	bool CSVReader::ReadRow(std::vector<std::string_view> &row, char splitter) {
+		bool res = false;
+		do {
+			row.clear();
+			const char *p = nullptr;
+			const char *end = nullptr;
+			if (!_nextLine(p, end)) {
+				break;
+			}
+			res = true;
+			while (true) {
+				const char *next = static_cast<const char *>(std::memchr(p, splitter, end - p));
+				if (nullptr == next) {
+					row.emplace_back(p, end - p);
+					break;
+				}
+				row.emplace_back(p, next - p);
+				p = next + 1;
+			}
+		} while (false);
+		return res;
+	}
+	const CSVReader::Error &CSVReader::LastError() const {
+		return _error;
+	}
+	bool CSVReader::_nextLine(const char *&begin, const char *&end) {
+		bool res = false;
+		do {
+			if (_cursor >= _end) {
+				break;
+			}
+			begin = _cursor;
+			const char *eol = static_cast<const char *>(std::memchr(_cursor, '\n', _end - _cursor));
+			end = (nullptr == eol) ? _end : eol;
+			_cursor = (nullptr == eol) ? _end : eol + 1;
+			if ((end > begin) && ('\r' == end[-1])) {
+				--end;
+			}
+			_row++;
+			res = true;
+		} while (false);
+		return res;
+	}
 }
@@ -4,18 +4,93 @@
 #ifndef IO_CSVREADER_HPP
 #define IO_CSVREADER_HPP
 
+#include "io/mappedfile.hpp"
+#include "profile/profiler.hpp"
+#include <charconv>
 #include <fstream>
+#include <string_view>
 #include <vector>
 
 namespace IO {
+	/*
+		Open() reads the file as a stream, row by row into strings.
+		OpenMapped() maps the whole file to memory: rows are returned as string_view
+		fields pointing into the mapping, or parsed by std::from_chars straight into
+		caller's numeric buffer. The mapped mode never throws, parsing errors are
+		reported by Status::Error and LastError().
+	*/
 	class CSVReader {
 		public:
+			enum class Status {
+				Ok,
+				End,
+				Error
+			};
+			enum class ErrorCode {
+				None,
+				NotNumber,
+				OutOfRange,
+				TooManyFields
+			};
+			struct Error {
+				size_t row; // 1-based row of the file
+				size_t column; // 0-based field of the row
+				ErrorCode code;
+			};
+
 			CSVReader();
 			bool Open(const std::string &filename);
+			bool OpenMapped(const std::string &filename);
 			void Close();
 			bool ReadRow(std::vector<std::string> &row, char splitter);
+			bool ReadRow(std::vector<std::string_view> &row, char splitter);
+			// parses one row of numbers to values[0..count), at most capacity of them;
+			// the row is consumed even if it has an error
+			template <class T> Status ParseRow(T *values, size_t capacity, size_t &count, char splitter) {
+				Status res = Status::Error;
+				count = 0;
+				do {
+					const char *p = nullptr;
+					const char *end = nullptr;
+					if (!_nextLine(p, end)) {
+						res = Status::End;
+						break;
+					}
+					PROFILE_SCOPE(Parse, -1, 0, end - p);
+					_error = {_row, 0, ErrorCode::None};
+					while (ErrorCode::None == _error.code) {
+						if (count == capacity) {
+							_error.code = ErrorCode::TooManyFields;
+							break;
+						}
+						std::from_chars_result r = std::from_chars(p, end, values[count]);
+						if (std::errc::result_out_of_range == r.ec) {
+							_error.code = ErrorCode::OutOfRange;
+						} else if ((std::errc() != r.ec) || ((r.ptr != end) && (*r.ptr != splitter))) {
+							_error.code = ErrorCode::NotNumber;
+						}
+						_error.column = count++;
+						if ((ErrorCode::None != _error.code) || (r.ptr == end)) {
+							break;
+						}
+						p = r.ptr + 1;
+					}
+					if (ErrorCode::None != _error.code) {
+						break;
+					}
+					res = Status::Ok;
+				} while (false);
+				return res;
+			}
+			const Error &LastError() const;
 		private:
+			bool _nextLine(const char *&begin, const char *&end);
 			std::ifstream ifs;
+			MappedFile _file;
+			const char *_cursor;
+			const char *_end;
+			size_t _row;
+			Error _error;
 	};
 }
 
@@ -0,0 +1,208 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#include "io/dataset.hpp"
+#include "io/csvreader.hpp"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace IO {
+	static const char DATASET_MAGIC[8] = {'P', 'C', 'P', 'T', 'D', 'S', 'E', 'T'};
+
+	static uint64_t AlignUp(uint64_t v) {
+		return (v + DATASET_ALIGN - 1)/DATASET_ALIGN*DATASET_ALIGN;
+	}
+
+	DatasetWriter::DatasetWriter() {
+	}
+	DatasetWriter::~DatasetWriter() {
+		Discard();
+	}
+	bool DatasetWriter::Open(const std::string &filename, size_t features) {
+		bool res = false;
+		do {
+			if (!_f.Open(filename + ".tmp")) {
+				break;
+			}
+			_filename = filename;
+			std::memset(&_header, 0, sizeof(_header));
+			std::memcpy(_header.magic, DATASET_MAGIC, sizeof(_header.magic));
+			_header.version = DATASET_VERSION;
+			_header.endian = DATASET_ENDIAN;
+			_header.features = features;
+			_header.stride = AlignUp(features);
+			_header.featuresOffset = AlignUp(sizeof(_header));
+			_labels.clear();
+			_padding.assign(DATASET_ALIGN, 0);
+			// the header is rewritten with the final count on Close
+			if (!_f.Write(_header)) {
+				break;
+			}
+			if (!_f.Write(_padding.data(), _header.featuresOffset - sizeof(_header))) {
+				break;
+			}
+			res = true;
+		} while (false);
+		return res;
+	}
+	bool DatasetWriter::Append(const uint8_t *features, uint8_t label) {
+		bool res = false;
+		do {
+			if (!_f.Write(features, _header.features)) {
+				break;
+			}
+			if (!_f.Write(_padding.data(), _header.stride - _header.features)) {
+				break;
+			}
+			_labels.push_back(label);
+			res = true;
+		} while (false);
+		return res;
+	}
+	bool DatasetWriter::Close() {
+		bool res = false;
+		do {
+			_header.count = _labels.size();
+			_header.labelsOffset = _header.featuresOffset + _header.count*_header.stride;
+			if (!_f.Write(_labels.data(), _labels.size())) {
+				break;
+			}
+			if (!_f.Write(_padding.data(), AlignUp(_labels.size()) - _labels.size())) {
+				break;
+			}
+			if (!_f.Seek(0)) {
+				break;
+			}
+			if (!_f.Write(_header) || !_f.Flush()) {
+				break;
+			}
+			_f.Close();
+			if (0 != std::rename((_filename + ".tmp").c_str(), _filename.c_str())) {
+				break;
+			}
+			_filename.clear();
+			res = true;
+		} while (false);
+		Discard();
+		return res;
+	}
+	void DatasetWriter::Discard() {
+		_f.Close();
+		if (!_filename.empty()) {
+			std::remove((_filename + ".tmp").c_str());
+			_filename.clear();
+		}
+	}
+	bool DatasetWriter::ConvertCSV(const std::string &csvname, const std::string &filename, size_t features, bool hasHeader) {
+		bool res = false;
+		do {
+			CSVReader csv;
+			std::vector<std::string_view> header;
+			if (!csv.OpenMapped(csvname)) {
+				break;
+			}
+			if (hasHeader && !csv.ReadRow(header, ',')) {
+				break;
+			}
+			DatasetWriter writer;
+			if (!writer.Open(filename, features)) {
+				break;
+			}
+			std::vector<int> row(features + 1);
+			std::vector<uint8_t> sample(features);
+			bool failed = false;
+			CSVReader::Status status;
+			size_t count = 0;
+			while (CSVReader::Status::End != (status = csv.ParseRow(row.data(), row.size(), count, ','))) {
+				const CSVReader::Error &e = csv.LastError();
+				if (CSVReader::Status::Error == status) {
+					std::cerr << "row #" << e.row << " field #" << e.column << ((CSVReader::ErrorCode::TooManyFields == e.code) ? " is extra" : " is not a number") << "... skipping" << std::endl;
+					continue;
+				}
+				if (row.size() != count) {
+					std::cerr << "row #" << e.row << " has incorrect size... skipping" << std::endl;
+					continue;
+				}
+				bool valid = true;
+				for (size_t i = 0; i <= features; ++i) {
+					valid = valid && (row[i] >= 0) && (row[i] <= 255);
+				}
+				if (!valid) {
+					std::cerr << "row #" << e.row << " contains out-of-range values... skipping" << std::endl;
+					continue;
+				}
+				for (size_t i = 0; i < features; ++i) {
+					sample[i] = row[i + 1];
+				}
+				if (!writer.Append(sample.data(), row[0])) {
+					failed = true;
+					break;
+				}
+			}
+			if (failed || !writer.Close()) { // a failed writer deletes its file
+				break;
+			}
+			res = true;
+		} while (false);
+		return res;
+	}
+
+	Dataset::Dataset()
+		: _header(nullptr) {
+	}
+	bool Dataset::Open(const std::string &filename) {
+		bool res = false;
+		do {
+			Close();
+			if (!_file.Open(filename)) {
+				break;
+			}
+			if (_file.Size() < sizeof(DatasetHeader)) {
+				break;
+			}
+			const DatasetHeader *h = reinterpret_cast<const DatasetHeader *>(_file.Data());
+			if (0 != std::memcmp(h->magic, DATASET_MAGIC, sizeof(h->magic))) {
+				break;
+			}
+			if ((DATASET_VERSION != h->version) || (DATASET_ENDIAN != h->endian)) {
+				break;
+			}
+			if ((h->stride < h->features) || (0 != h->featuresOffset % DATASET_ALIGN) || (0 != h->stride % DATASET_ALIGN)) {
+				break;
+			}
+			// sizes are checked against the file before they are multiplied, a crafted header can't overflow
+			// them; features may not overlap the header
+			if ((h->featuresOffset < sizeof(DatasetHeader)) || (h->featuresOffset > _file.Size()) || ((0 != h->stride) && (h->count > (_file.Size() - h->featuresOffset)/h->stride))) {
+				break;
+			}
+			if ((h->labelsOffset != h->featuresOffset + h->count*h->stride) || (h->count > _file.Size() - h->labelsOffset)) {
+				break;
+			}
+			_header = h;
+			res = true;
+		} while (false);
+		if (!res) {
+			_file.Close();
+		}
+		return res;
+	}
+	void Dataset::Close() {
+		_header = nullptr;
+		_file.Close();
+	}
+	size_t Dataset::Count() const {
+		return (nullptr == _header) ? 0 : _header->count;
+	}
+	size_t Dataset::Features() const {
+		return (nullptr == _header) ? 0 : _header->features;
+	}
+	Dataset::SampleView Dataset::Sample(size_t i) const {
+		if (i >= Count()) {
+			throw std::runtime_error("Sample Out Of Range");
+		}
+		const uint8_t *base = _file.Data();
+		return {base + _header->featuresOffset + i*_header->stride, base[_header->labelsOffset + i]};
+	}
+}
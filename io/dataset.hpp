@@ -0,0 +1,77 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef IO_DATASET_HPP
+#define IO_DATASET_HPP
+
+#include "io/filewriter.hpp"
+#include "io/mappedfile.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace IO {
+	/*
+		Binary dataset of uint8 feature vectors with uint8 labels:
+			header;
+			Count rows of Features bytes, each row padded to Stride bytes;
+			Count labels.
+		Every section and every row starts at an offset aligned to DATASET_ALIGN.
+	*/
+	static constexpr size_t DATASET_ALIGN = 64;
+	static constexpr uint32_t DATASET_VERSION = 1;
+	static constexpr uint32_t DATASET_ENDIAN = 0x01020304;
+
+	struct DatasetHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t endian;
+		uint64_t count;
+		uint64_t features;
+		uint64_t stride;
+		uint64_t featuresOffset;
+		uint64_t labelsOffset;
+	};
+
+	// Writes <filename>.tmp and renames it to filename on a successful Close, so an
+	// interrupted or failed conversion never leaves a partial dataset under the final name.
+	class DatasetWriter {
+		public:
+			DatasetWriter();
+			~DatasetWriter();
+			bool Open(const std::string &filename, size_t features);
+			bool Append(const uint8_t *features, uint8_t label);
+			bool Close();
+			// closes and deletes the unfinished file
+			void Discard();
+			// one-time conversion of CSV with rows "label,feature,feature,..." (values 0-255);
+			// malformed rows are reported to std::cerr and skipped
+			static bool ConvertCSV(const std::string &csvname, const std::string &filename, size_t features, bool hasHeader=true);
+		private:
+			FileWriter _f;
+			std::string _filename;
+			DatasetHeader _header;
+			std::vector<uint8_t> _labels;
+			std::vector<uint8_t> _padding;
+	};
+
+	class Dataset {
+		public:
+			// zero-copy view of one sample, valid while the dataset is open
+			struct SampleView {
+				const uint8_t *features;
+				uint8_t label;
+			};
+			Dataset();
+			bool Open(const std::string &filename);
+			void Close();
+			size_t Count() const;
+			size_t Features() const;
+			SampleView Sample(size_t i) const;
+		private:
+			MappedFile _file;
+			const DatasetHeader *_header;
+	};
+}
+
+#endif
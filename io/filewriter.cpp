@@ -20,6 +20,39 @@ namespace IO {
 		} while (false);
 		return res;
 	}
+	bool FileWriter::Write(const void *data, size_t size) {
+		bool res = false;
+		do {
+			if (!ofs.write(static_cast<const char *>(data), size)) {
+				break;
+			}
+			res = true;
+		} while (false);
+		return res;
+	}
+	bool FileWriter::Flush() {
+		bool res = false;
+		do {
+			if (!ofs.flush()) {
+				break;
+			}
+			res = true;
+		} while (false);
+		return res;
+	}
+	uint64_t FileWriter::Tell() {
+		return ofs.tellp();
+	}
+	bool FileWriter::Seek(uint64_t pos) {
+		bool res = false;
+		do {
+			if (!ofs.seekp(pos)) {
+				break;
+			}
+			res = true;
+		} while (false);
+		return res;
+	}
 	void FileWriter::Close() {
 		do {
 			if (!IsOpen()) {
@@ -4,6 +4,7 @@
 #ifndef IO_FILEWRITER_HPP
 #define IO_FILEWRITER_HPP
 
+#include <cstdint>
 #include <fstream>
 
 namespace IO {
@@ -13,6 +14,11 @@ namespace IO {
 			bool IsOpen();
 			bool Open(const std::string &filename);
 			void Close();
+			bool Write(const void *data, size_t size);
+			// pushes buffered data to the file, false if it can't be written
+			bool Flush();
+			uint64_t Tell();
+			bool Seek(uint64_t pos);
 			template <class T> bool Write(const T &val) {
 				bool res = false;
 				do {
@@ -0,0 +1,96 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#include "io/mappedfile.hpp"
+#include <fstream>
+#if defined(__unix__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#define IO_HAVE_MMAP
+#endif
+
+namespace IO {
+	MappedFile::MappedFile()
+		: _data(nullptr)
+		, _size(0)
+		, _mapped(false) {
+	}
+	MappedFile::~MappedFile() {
+		Close();
+	}
+	bool MappedFile::IsOpen() const {
+		return nullptr != _data;
+	}
+	bool MappedFile::Open(const std::string &filename) {
+		bool res = false;
+		do {
+			if (IsOpen()) {
+				break;
+			}
+#ifdef IO_HAVE_MMAP
+			int fd = open(filename.c_str(), O_RDONLY);
+			if (fd < 0) {
+				break;
+			}
+			struct stat st;
+			if ((0 != fstat(fd, &st)) || (0 == st.st_size)) {
+				close(fd);
+				break;
+			}
+			void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (MAP_FAILED == p) {
+				break;
+			}
+			madvise(p, st.st_size, MADV_WILLNEED);
+			_data = static_cast<const uint8_t *>(p);
+			_size = st.st_size;
+			_mapped = true;
+#else
+			std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+			if (!ifs.is_open()) {
+				break;
+			}
+			std::streamoff size = ifs.tellg();
+			if (size <= 0) {
+				break;
+			}
+			_buffer.resize(size);
+			ifs.seekg(0);
+			if (!ifs.read(reinterpret_cast<char *>(_buffer.data()), size)) {
+				_buffer.clear();
+				break;
+			}
+			_data = _buffer.data();
+			_size = _buffer.size();
+#endif
+			res = true;
+		} while (false);
+		return res;
+	}
+	void MappedFile::Close() {
+		do {
+			if (!IsOpen()) {
+				break;
+			}
+#ifdef IO_HAVE_MMAP
+			if (_mapped) {
+				munmap(const_cast<uint8_t *>(_data), _size);
+			}
+#endif
+			_buffer.clear();
+			_buffer.shrink_to_fit();
+			_data = nullptr;
+			_size = 0;
+			_mapped = false;
+		} while (false);
+	}
+	const uint8_t *MappedFile::Data() const {
+		return _data;
+	}
+	size_t MappedFile::Size() const {
+		return _size;
+	}
+}
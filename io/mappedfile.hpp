@@ -0,0 +1,33 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef IO_MAPPEDFILE_HPP
+#define IO_MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace IO {
+	// Read-only view of a whole file. The file is memory-mapped where the platform
+	// supports it, otherwise it is read into memory once.
+	class MappedFile {
+		public:
+			MappedFile();
+			~MappedFile();
+			MappedFile(const MappedFile &) = delete;
+			MappedFile &operator = (const MappedFile &) = delete;
+			bool IsOpen() const;
+			bool Open(const std::string &filename);
+			void Close();
+			const uint8_t *Data() const;
+			size_t Size() const;
+		private:
+			const uint8_t *_data;
+			size_t _size;
+			bool _mapped;
+			std::vector<uint8_t> _buffer;
+	};
+}
+#endif
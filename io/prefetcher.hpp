@@ -0,0 +1,176 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef IO_PREFETCHER_HPP
+#define IO_PREFETCHER_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace IO {
+	/*
+		Input pipeline stage: producer threads decode items into a bounded ring of
+		preallocated ITEM buffers while the consumer takes filled ones from the other end.
+		Every source runs in its own thread and returns false at the end of its stream,
+		Acquire() returns nullptr when all sources are exhausted and all items are consumed.
+		Producers block while all buffers are filled or taken (backpressure).
+		With one source the order of items is preserved. An exception thrown by a source ends
+		its stream and is rethrown by the next Acquire().
+	*/
+	template <class ITEM> class Prefetcher {
+		public:
+			using Source = std::function<bool(ITEM &)>;
+
+			// capacity is at least one item
+			Prefetcher(size_t capacity, const ITEM &prototype)
+				: _slots(std::max<size_t>(1, capacity), prototype)
+				, _free(_slots.size())
+				, _ready(_slots.size())
+				, _producers(0)
+				, _stopping(false) {
+				for (size_t i = 0; i < _slots.size(); ++i) {
+					_free.Push(i);
+				}
+			}
+			~Prefetcher() {
+				Stop();
+			}
+			Prefetcher(const Prefetcher &) = delete;
+			Prefetcher &operator = (const Prefetcher &) = delete;
+
+			void Start(const std::vector<Source> &sources) {
+				Stop();
+				std::unique_lock<std::mutex> lock(_mutex);
+				_stopping = false;
+				_error = nullptr;
+				_producers = sources.size();
+				for (const Source &source: sources) {
+					_threads.emplace_back(&Prefetcher::_produce, this, source);
+				}
+			}
+			void Start(const Source &source) {
+				Start(std::vector<Source>(1, source));
+			}
+			// next filled item, blocks until it is ready; nullptr at the end of all streams
+			ITEM *Acquire() {
+				ITEM *res = nullptr;
+				std::unique_lock<std::mutex> lock(_mutex);
+				_readyCV.wait(lock, [this]() {
+					return !_ready.Empty() || (0 == _producers) || _error;
+				});
+				if (_error) {
+					std::exception_ptr error;
+					std::swap(error, _error);
+					std::rethrow_exception(error);
+				}
+				if (!_ready.Empty()) {
+					res = &_slots[_ready.Pop()];
+				}
+				return res;
+			}
+			// gives the item taken by Acquire() back to producers
+			void Release(ITEM *item) {
+				std::unique_lock<std::mutex> lock(_mutex);
+				_free.Push(item - _slots.data());
+				_freeCV.notify_one();
+			}
+			// stops producers and drops items not consumed yet
+			void Stop() {
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_stopping = true;
+					_freeCV.notify_all();
+				}
+				for (std::thread &t: _threads) {
+					t.join();
+				}
+				_threads.clear();
+				std::unique_lock<std::mutex> lock(_mutex);
+				while (!_ready.Empty()) {
+					_free.Push(_ready.Pop());
+				}
+			}
+
+		private:
+			// fixed capacity FIFO of slot indices
+			class Ring {
+				public:
+					Ring(size_t capacity)
+						: _items(capacity)
+						, _head(0)
+						, _count(0) {
+					}
+					bool Empty() const {
+						return 0 == _count;
+					}
+					void Push(size_t v) {
+						_items[(_head + _count++) % _items.size()] = v;
+					}
+					size_t Pop() {
+						size_t v = _items[_head];
+						_head = (_head + 1) % _items.size();
+						_count--;
+						return v;
+					}
+				private:
+					std::vector<size_t> _items;
+					size_t _head;
+					size_t _count;
+			};
+
+			void _produce(Source source) {
+				while (true) {
+					size_t slot = 0;
+					{
+						std::unique_lock<std::mutex> lock(_mutex);
+						_freeCV.wait(lock, [this]() {
+							return !_free.Empty() || _stopping;
+						});
+						if (_stopping) {
+							break;
+						}
+						slot = _free.Pop();
+					}
+					bool filled = false;
+					std::exception_ptr error;
+					try {
+						filled = source(_slots[slot]);
+					} catch (...) {
+						error = std::current_exception();
+					}
+					std::unique_lock<std::mutex> lock(_mutex);
+					if (error && !_error) { // the first one goes to the consumer
+						_error = error;
+					}
+					if (!filled) {
+						_free.Push(slot);
+						_freeCV.notify_one();
+						break;
+					}
+					_ready.Push(slot);
+					_readyCV.notify_one();
+				}
+				std::unique_lock<std::mutex> lock(_mutex);
+				_producers--;
+				_readyCV.notify_all();
+			}
+
+			std::vector<ITEM> _slots;
+			Ring _free;
+			Ring _ready;
+			size_t _producers;
+			bool _stopping;
+			std::exception_ptr _error; // thrown by a source, not rethrown yet
+			std::mutex _mutex;
+			std::condition_variable _freeCV;
+			std::condition_variable _readyCV;
+			std::vector<std::thread> _threads;
+	};
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_ALLOCATOR_HPP
+#define LINALG_ALLOCATOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+
+namespace LinAlg {
+	// alignment of linalg storage: a cache line, the widest SIMD register
+	static constexpr size_t STORAGE_ALIGN = 64;
+
+	// Number of heap allocations made for linalg storage since start of the process.
+	// The hot paths are expected to keep it constant in steady state.
+	inline std::atomic<size_t> &AllocationCounter() {
+		static std::atomic<size_t> counter(0);
+		return counter;
+	}
+	inline size_t Allocations() {
+		return AllocationCounter().load(std::memory_order_relaxed);
+	}
+
+	// counts allocations and aligns them to STORAGE_ALIGN
+	template <class T> class Allocator {
+		public:
+			using value_type = T;
+			using is_always_equal = std::true_type;
+			Allocator() = default;
+			template <class U> Allocator(const Allocator<U> &) {
+			}
+			T *allocate(size_t n) {
+				AllocationCounter().fetch_add(1, std::memory_order_relaxed);
+				return static_cast<T *>(::operator new(n*sizeof(T), std::align_val_t(STORAGE_ALIGN)));
+			}
+			void deallocate(T *p, size_t) {
+				::operator delete(p, std::align_val_t(STORAGE_ALIGN));
+			}
+			template <class U> bool operator == (const Allocator<U> &) const {
+				return true;
+			}
+			template <class U> bool operator != (const Allocator<U> &) const {
+				return false;
+			}
+	};
+}
+
+#endif
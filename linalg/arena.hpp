@@ -0,0 +1,89 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_ARENA_HPP
+#define LINALG_ARENA_HPP
+
+#include "linalg/allocator.hpp"
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+#if defined(__unix__) || defined(__APPLE__)
+	#include <sys/mman.h> // MADV_HUGEPAGE, elsewhere the hint is skipped
+#endif
+
+namespace LinAlg {
+	// One zero-initialized block of memory aligned to a cache line. With huge pages it is
+	// aligned and sized to 2 MB and advised to the kernel as a transparent huge page region,
+	// so a large model takes a few TLB entries (the kernel may still use small pages).
+	class Arena {
+		public:
+			static constexpr size_t ALIGN = STORAGE_ALIGN;
+			static constexpr size_t HUGE_PAGE = size_t(2) << 20;
+
+			Arena()
+				: _data(nullptr)
+				, _bytes(0)
+				, _align(ALIGN)
+				, _hugePages(false) {
+			}
+			explicit Arena(size_t bytes, bool hugePages=false)
+				: Arena() {
+				if (0 != bytes) {
+					const size_t align = hugePages ? HUGE_PAGE : ALIGN;
+					const size_t size = (bytes + align - 1)/align*align;
+					_data = ::operator new(size, std::align_val_t(align)); // std::aligned_alloc is not on every platform
+					_align = align;
+					AllocationCounter().fetch_add(1, std::memory_order_relaxed);
+#ifdef MADV_HUGEPAGE
+					if (hugePages) {
+						_hugePages = (0 == madvise(_data, size, MADV_HUGEPAGE));
+					}
+#endif
+					std::memset(_data, 0, size);
+					_bytes = bytes;
+				}
+			}
+			Arena(Arena &&other)
+				: Arena() {
+				*this = std::move(other);
+			}
+			Arena &operator = (Arena &&other) {
+				std::swap(_data, other._data);
+				std::swap(_bytes, other._bytes);
+				std::swap(_align, other._align);
+				std::swap(_hugePages, other._hugePages);
+				return *this;
+			}
+			Arena(const Arena &) = delete;
+			Arena &operator = (const Arena &) = delete;
+			~Arena() {
+				if (nullptr != _data) {
+					::operator delete(_data, std::align_val_t(_align));
+				}
+			}
+
+			void *Data() {
+				return _data;
+			}
+			const void *Data() const {
+				return _data;
+			}
+			size_t Bytes() const {
+				return _bytes;
+			}
+			// the kernel accepted the huge page advice
+			bool HugePages() const {
+				return _hugePages;
+			}
+
+		private:
+			void *_data;
+			size_t _bytes;
+			size_t _align;
+			bool _hugePages;
+	};
+}
+
+#endif
@@ -0,0 +1,357 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_AUTOTUNER_HPP
+#define LINALG_AUTOTUNER_HPP
+
+#include "linalg/gemm.hpp"
+#include "linalg/threadpool.hpp"
+#include "profile/profiler.hpp"
+#include "io/filereader.hpp"
+#include "io/filewriter.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace LinAlg {
+	/*
+		Chooses the GEMM kernel (naive or blocked) and the number of threads for every
+		problem shape. Choices are cached by (M, N, K, number types, operand layout, available
+		threads, active instruction set of linalg/isa.hpp), B may be kept in a compact storage type (linalg/half.hpp). A shape seen for the first time is computed by a size based guess and queued,
+		a background thread benchmarks the candidates on its own scratch buffers and thread pool
+		and publishes the fastest one, so the caller never waits for tuning. Tune() does the same
+		synchronously, Save()/Load() keep the cache between runs. Lookups of tuned shapes take
+		no lock, they read a published copy of the cache.
+	*/
+	class Autotuner {
+		public:
+			enum class Kernel : uint8_t {
+				Naive,
+				Blocked
+			};
+			struct Choice {
+				Kernel kernel;
+				uint16_t threads; // 1 is serial
+			};
+			struct Key {
+				uint32_t m;
+				uint32_t n;
+				uint32_t k;
+				uint8_t type; // sizeof(NUMBER), sizeof(TB) in the high nibble when B is stored in another type
+				uint8_t layout; // bit 0: A is column-major, bit 1: B is column-major
+				uint16_t threads;
+				uint8_t isa; // LinAlg::Isa kernels were built for
+				bool operator < (const Key &other) const {
+					return std::tie(m, n, k, type, layout, threads, isa) < std::tie(other.m, other.n, other.k, other.type, other.layout, other.threads, other.isa);
+				}
+			};
+
+			static Autotuner &Instance() {
+				static Autotuner tuner;
+				return tuner;
+			}
+			~Autotuner() {
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_stopping = true;
+					_queueCV.notify_all();
+				}
+				if (_worker.joinable()) {
+					_worker.join();
+				}
+			}
+			Autotuner(const Autotuner &) = delete;
+			Autotuner &operator = (const Autotuner &) = delete;
+
+			// C = alpha*A*B + beta*C by the kernel chosen for this shape, arguments as of Gemm::Gemm
+			template <class NUMBER, class TB = NUMBER> void Gemm(size_t M, size_t N, size_t K, NUMBER alpha, const NUMBER *A, size_t rsa, size_t csa, const TB *B, size_t rsb, size_t csb, NUMBER beta, NUMBER *C, size_t ldc) {
+				const Key key = MakeKey<NUMBER, TB>(M, N, K, csa, csb);
+				Choice choice = {Kernel::Blocked, 1};
+				if (!_find(key, choice)) {
+					choice = _guess(key);
+					_request(key, &Autotuner::_tune<NUMBER, TB>);
+				}
+				Run(choice, M, N, K, alpha, A, rsa, csa, B, rsb, csb, beta, C, ldc);
+			}
+			template <class NUMBER, class TB = NUMBER> static void Run(const Choice &choice, size_t M, size_t N, size_t K, NUMBER alpha, const NUMBER *A, size_t rsa, size_t csa, const TB *B, size_t rsb, size_t csb, NUMBER beta, NUMBER *C, size_t ldc) {
+				const bool parallel = choice.threads > 1;
+				ThreadPool::Limit limit(choice.threads);
+				if (Kernel::Naive == choice.kernel) {
+					Gemm::Naive<NUMBER, TB>(M, N, K, alpha, A, rsa, csa, B, rsb, csb, beta, C, ldc, parallel);
+				} else {
+					Gemm::Gemm<NUMBER, TB>(M, N, K, alpha, A, rsa, csa, B, rsb, csb, beta, C, ldc, parallel);
+				}
+			}
+			template <class NUMBER, class TB = NUMBER> static Key MakeKey(size_t M, size_t N, size_t K, size_t csa, size_t csb) {
+				Key key;
+				key.m = M;
+				key.n = N;
+				key.k = K;
+				key.type = std::is_same<NUMBER, TB>::value ? sizeof(NUMBER) : (sizeof(NUMBER) | (sizeof(TB) << 4));
+				key.layout = ((1 != csa) ? 1 : 0) | ((1 != csb) ? 2 : 0);
+				key.threads = _threads();
+				key.isa = uint8_t(ActiveIsa());
+				return key;
+			}
+
+			// benchmarks the shape right now (row-major operands unless layout says otherwise)
+			template <class NUMBER, class TB = NUMBER> Choice Tune(size_t M, size_t N, size_t K, uint8_t layout = 0) {
+				Key key = MakeKey<NUMBER, TB>(M, N, K, (layout & 1) ? M : 1, (layout & 2) ? K : 1);
+				_tune<NUMBER, TB>(key);
+				std::unique_lock<std::mutex> lock(_mutex);
+				auto it = _cache.find(key);
+				return (_cache.end() != it) ? it->second : _guess(key); // not tuned if kernels were switched meanwhile
+			}
+			// blocks until all queued shapes are tuned
+			void Wait() {
+				std::unique_lock<std::mutex> lock(_mutex);
+				_idleCV.wait(lock, [this]() {
+					return _queue.empty() && !_busy;
+				});
+			}
+			size_t Size() {
+				std::unique_lock<std::mutex> lock(_mutex);
+				return _cache.size();
+			}
+			void Clear() {
+				std::unique_lock<std::mutex> lock(_mutex);
+				_cache.clear();
+				_publish();
+			}
+
+			bool Save(const std::string &filename) {
+				bool res = false;
+				do {
+					IO::FileWriter f;
+					if (!f.Open(filename)) {
+						break;
+					}
+					std::unique_lock<std::mutex> lock(_mutex);
+					if (!f.Write(MAGIC, sizeof(MAGIC)) || !f.Write<uint32_t>(VERSION) || !f.Write<uint32_t>(_cache.size())) {
+						break;
+					}
+					bool written = true;
+					for (auto it = _cache.begin(); written && (_cache.end() != it); ++it) {
+						written = f.Write(it->first.m) && f.Write(it->first.n) && f.Write(it->first.k) && f.Write(it->first.type) && f.Write(it->first.layout) && f.Write(it->first.threads) && f.Write(it->first.isa) && f.Write(it->second.kernel) && f.Write(it->second.threads);
+					}
+					res = written;
+				} while (false);
+				return res;
+			}
+			// Merges choices from the file into the cache, they win over the ones made so far.
+			// A file with a choice of 0 threads or more threads than its key's pool has is rejected.
+			bool Load(const std::string &filename) {
+				bool res = false;
+				do {
+					IO::FileReader f;
+					if (!f.Open(filename)) {
+						break;
+					}
+					char magic[sizeof(MAGIC)];
+					uint32_t version = 0;
+					uint32_t count = 0;
+					if (!f.Read(magic) || (0 != std::memcmp(magic, MAGIC, sizeof(MAGIC))) || !f.Read(version) || (VERSION != version) || !f.Read(count)) {
+						break;
+					}
+					std::map<Key, Choice> loaded;
+					bool read = true;
+					for (uint32_t i = 0; read && (i < count); ++i) {
+						Key key = {};
+						Choice choice;
+						read = f.Read(key.m) && f.Read(key.n) && f.Read(key.k) && f.Read(key.type) && f.Read(key.layout) && f.Read(key.threads) && f.Read(key.isa) && f.Read(choice.kernel) && f.Read(choice.threads);
+						if (read && ((Kernel::Blocked < choice.kernel) || (0 == choice.threads) || (key.threads < choice.threads))) { // unknown kernel or thread count
+							read = false;
+						}
+						loaded[key] = choice;
+					}
+					if (!read) {
+						break;
+					}
+					std::unique_lock<std::mutex> lock(_mutex);
+					for (auto &kv: loaded) {
+						_cache[kv.first] = kv.second;
+					}
+					_publish();
+					res = true;
+				} while (false);
+				return res;
+			}
+
+		private:
+			static constexpr char MAGIC[8] = {'P', 'C', 'P', 'T', 'T', 'U', 'N', 'E'};
+			static constexpr uint32_t VERSION = 2;
+			static constexpr size_t REPEATS = 3;
+			static constexpr size_t MAX_REPEATS = 50;
+			static constexpr double MIN_TIME = 1e-3; // seconds per candidate
+			static constexpr size_t PARALLEL_WORK = 1 << 18; // multiply-adds worth a parallel region, until measured
+
+			using TuneFunction = void (Autotuner::*)(const Key &);
+			struct Request {
+				Key key;
+				TuneFunction tune;
+			};
+
+			Autotuner()
+				: _table(std::make_shared<const Table>())
+				, _version(0)
+				, _busy(false)
+				, _stopping(false) {
+			}
+			// Lookups read a thread's own reference to the published table, the lock is taken
+			// only to pick up a table published after the thread's last lookup.
+			bool _find(const Key &key, Choice &choice) {
+				struct Local {
+					uint64_t version = ~uint64_t(0);
+					std::shared_ptr<const Table> table;
+				};
+				thread_local Local local;
+				const uint64_t version = _version.load(std::memory_order_acquire);
+				if (local.version != version) {
+					std::unique_lock<std::mutex> lock(_mutex);
+					local.table = _table;
+					local.version = _version.load(std::memory_order_relaxed);
+				}
+				auto it = local.table->find(key);
+				const bool res = (local.table->end() != it);
+				if (res) {
+					choice = it->second;
+				}
+				return res;
+			}
+			// a read-only copy of the cache for lookups, under _mutex
+			void _publish() {
+				_table = std::make_shared<const Table>(_cache);
+				_version.fetch_add(1, std::memory_order_release);
+			}
+			static uint16_t _threads() {
+				return ThreadPool::Current().Threads();
+			}
+			static Choice _guess(const Key &key) {
+				const size_t work = size_t(key.m)*key.n*key.k;
+				return {Kernel::Blocked, (work >= PARALLEL_WORK) ? key.threads : uint16_t(1)};
+			}
+			void _request(const Key &key, TuneFunction tune) {
+				std::unique_lock<std::mutex> lock(_mutex);
+				if (_stopping || (_cache.end() != _cache.find(key)) || !_requested.insert(key).second) {
+					return;
+				}
+				_queue.push_back({key, tune});
+				if (!_worker.joinable()) {
+					_worker = std::thread(&Autotuner::_loop, this);
+				}
+				_queueCV.notify_one();
+			}
+			void _loop() {
+#ifdef PROFILE_ENABLED
+				Profile::Profiler::IgnoreThisThread(); // benchmarks of candidates are not the application's work
+#endif
+				// candidates run on a pool of their own: on the shared one they would run inline
+				// while the application uses it, and the application's products while they run
+				ThreadPool pool(1);
+				ThreadPool::Scope scope(pool);
+				while (true) {
+					Request request;
+					{
+						std::unique_lock<std::mutex> lock(_mutex);
+						_queueCV.wait(lock, [this]() {
+							return _stopping || !_queue.empty();
+						});
+						if (_stopping) {
+							break;
+						}
+						request = _queue.front();
+						_queue.pop_front();
+						_busy = true;
+					}
+					if (pool.Threads() != request.key.threads) {
+						pool.SetThreads(request.key.threads);
+					}
+					(this->*request.tune)(request.key);
+					std::unique_lock<std::mutex> lock(_mutex);
+					_busy = false;
+					_idleCV.notify_all();
+				}
+			}
+			// best of the repeated runs of the candidate in seconds, infinity if a parallel
+			// candidate ran inline, so its time is not the one of its threads
+			template <class NUMBER, class TB> static double _measure(const Choice &choice, const Key &key, const NUMBER *A, const TB *B, NUMBER *C) {
+				using Clock = std::chrono::high_resolution_clock;
+				const size_t rsa = (key.layout & 1) ? 1 : key.k;
+				const size_t csa = (key.layout & 1) ? key.m : 1;
+				const size_t rsb = (key.layout & 2) ? 1 : key.n;
+				const size_t csb = (key.layout & 2) ? key.k : 1;
+				const size_t inlineRuns = ThreadPool::InlineRuns();
+				Run<NUMBER, TB>(choice, key.m, key.n, key.k, 1, A, rsa, csa, B, rsb, csb, 0, C, key.n); // warm up
+				double best = 1e300;
+				double total = 0;
+				for (size_t r = 0; (r < REPEATS) || ((total < MIN_TIME) && (r < MAX_REPEATS)); ++r) {
+					auto start = Clock::now();
+					Run<NUMBER, TB>(choice, key.m, key.n, key.k, 1, A, rsa, csa, B, rsb, csb, 0, C, key.n);
+					std::chrono::duration<double> elapsed = Clock::now() - start;
+					best = std::min(best, elapsed.count());
+					total += elapsed.count();
+				}
+				return (ThreadPool::InlineRuns() == inlineRuns) ? best : std::numeric_limits<double>::infinity();
+			}
+			template <class NUMBER, class TB> void _tune(const Key &key) {
+				if (uint8_t(ActiveIsa()) != key.isa) { // kernels were switched since the request, the shape comes again with the new key
+					std::unique_lock<std::mutex> lock(_mutex);
+					_requested.erase(key);
+					return;
+				}
+				std::vector<NUMBER> a(size_t(key.m)*key.k, NUMBER(0.5));
+				std::vector<TB> b(size_t(key.k)*key.n, TB(NUMBER(0.25)));
+				std::vector<NUMBER> c(size_t(key.m)*key.n);
+				std::vector<uint16_t> threads(1, 1);
+				for (uint16_t t = 2; t < key.threads; t *= 2) {
+					threads.push_back(t);
+				}
+				if (key.threads > 1) {
+					threads.push_back(key.threads);
+				}
+				Choice best = {Kernel::Blocked, 1};
+				double bestTime = 1e300;
+				for (Kernel kernel: {Kernel::Naive, Kernel::Blocked}) {
+					for (uint16_t t: threads) {
+						const Choice candidate = {kernel, t};
+						const double time = _measure<NUMBER, TB>(candidate, key, a.data(), b.data(), c.data());
+						if (time < bestTime) {
+							bestTime = time;
+							best = candidate;
+						}
+					}
+				}
+				std::unique_lock<std::mutex> lock(_mutex);
+				_cache[key] = best;
+				_publish();
+				_requested.erase(key);
+			}
+
+			using Table = std::map<Key, Choice>;
+			Table _cache;
+			std::shared_ptr<const Table> _table; // published copy of _cache
+			std::atomic<uint64_t> _version; // of _table
+			std::set<Key> _requested;
+			std::deque<Request> _queue;
+			bool _busy;
+			bool _stopping;
+			std::mutex _mutex;
+			std::condition_variable _queueCV;
+			std::condition_variable _idleCV;
+			std::thread _worker;
+	};
+}
+
+#endif
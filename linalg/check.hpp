@@ -0,0 +1,17 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_CHECK_HPP
+#define LINALG_CHECK_HPP
+
+#include <stdexcept>
+
+// Bounds checks of element accessors are compiled in only with LINALG_DEBUG (CMake Debug
+// builds or -DPERCEPTRON_DEBUG_CHECKS=ON), release builds index storage directly.
+#ifdef LINALG_DEBUG
+	#define LINALG_CHECK(condition, message) do { if (!(condition)) { throw std::runtime_error(message); } } while (false)
+#else
+	#define LINALG_CHECK(condition, message) do { } while (false)
+#endif
+
+#endif
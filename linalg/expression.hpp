@@ -0,0 +1,295 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_EXPRESSION_HPP
+#define LINALG_EXPRESSION_HPP
+
+#include "linalg/autotuner.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+/*
+	Lazy matrix expressions: +, -, scaling by a number and products build light objects that
+	refer to their operands, nothing is computed until an expression is assigned to a Matrix
+	or a MatrixView (or added to one by +=). Then it is evaluated by one loop straight into
+	the destination. A product is computed by GEMM into the destination, a product plus a
+	matrix (or a 1xN row added to every row, as a bias) is one GEMM over the destination
+	holding the addend. Operands of products are matrices or views (linalg/view.hpp) of any
+	strides, so transposed and sliced operands are not copied.
+	Expressions refer to their matrices, so they must not outlive them: do not keep them in
+	auto variables.
+	Every node provides:
+		Rows(), Cols();
+		Get(r, c) - element in the compute type;
+		Linear(), Get(i) - row-major elements may be taken by a single index;
+		Refers(f) - evaluation reads storage overlapping the footprint f;
+		Aliases(f) - evaluation reads elements of f other than the one it writes.
+	Leaves (matrices and views) also provide Data(), RowStride(), ColStride() and Storage().
+*/
+namespace LinAlg {
+	template <class NUMBER, class COMPUTE> class Matrix;
+
+	// memory taken by a strided block of elements
+	struct Footprint {
+		const uint8_t *begin;
+		const uint8_t *end;
+		size_t rs; // strides in elements
+		size_t cs;
+		size_t size; // of an element
+
+		template <class T> static Footprint Of(const T *data, size_t rows, size_t cols, size_t rs, size_t cs) {
+			const uint8_t *begin = reinterpret_cast<const uint8_t *>(data);
+			const size_t span = ((0 == rows) || (0 == cols)) ? 0 : ((rows - 1)*rs + (cols - 1)*cs + 1);
+			return {begin, begin + span*sizeof(T), rs, cs, sizeof(T)};
+		}
+		bool Overlaps(const Footprint &other) const {
+			return (begin < other.end) && (other.begin < end);
+		}
+		// element (r, c) of both is at the same address
+		bool Same(const Footprint &other) const {
+			return (begin == other.begin) && (rs == other.rs) && (cs == other.cs) && (size == other.size);
+		}
+	};
+
+	template <class E> struct Expression {
+		const E &Derived() const {
+			return static_cast<const E &>(*this);
+		}
+	};
+
+	// matrices are kept by reference, views and intermediate nodes by value
+	template <class E> struct ExpressionStorage {
+		using Type = const E;
+	};
+	template <class NUMBER, class COMPUTE> struct ExpressionStorage<Matrix<NUMBER, COMPUTE>> {
+		using Type = const Matrix<NUMBER, COMPUTE> &;
+	};
+
+	struct Plus {
+		template <class T> static T Apply(T a, T b) {
+			return a + b;
+		}
+	};
+	struct Minus {
+		template <class T> static T Apply(T a, T b) {
+			return a - b;
+		}
+	};
+
+	template <class E> class Scaled: public Expression<Scaled<E>> {
+		public:
+			using Compute = typename E::Compute;
+			Scaled(Compute k, const E &e)
+				: _k(k)
+				, _e(e) {
+			}
+			size_t Rows() const {
+				return _e.Rows();
+			}
+			size_t Cols() const {
+				return _e.Cols();
+			}
+			Compute Get(size_t r, size_t c) const {
+				return _k*_e.Get(r, c);
+			}
+			bool Linear() const {
+				return _e.Linear();
+			}
+			Compute Get(size_t i) const {
+				return _k*_e.Get(i);
+			}
+			bool Refers(const Footprint &f) const {
+				return _e.Refers(f);
+			}
+			bool Aliases(const Footprint &f) const {
+				return _e.Aliases(f);
+			}
+		private:
+			Compute _k;
+			typename ExpressionStorage<E>::Type _e;
+	};
+
+	// A*B where both operands are matrices or views, so GEMM takes them in place
+	template <class L, class R> class Product: public Expression<Product<L, R>> {
+		public:
+			using Compute = typename L::Compute;
+			Product(const L &l, const R &r)
+				: _l(l)
+				, _r(r) {
+				if (_l.Cols() != _r.Rows()) {
+					throw std::runtime_error("Matrix * Matrix size mismatch");
+				}
+			}
+			size_t Rows() const {
+				return _l.Rows();
+			}
+			size_t Cols() const {
+				return _r.Cols();
+			}
+			// element access computes the whole product once
+			Compute Get(size_t r, size_t c) const {
+				return _value().Get(r, c);
+			}
+			bool Linear() const {
+				return true;
+			}
+			Compute Get(size_t i) const {
+				return _value().Get(i);
+			}
+			bool Refers(const Footprint &f) const {
+				return _l.Refers(f) || _r.Refers(f) || ((nullptr != _cache) && _cache->Refers(f));
+			}
+			bool Aliases(const Footprint &f) const {
+				return _l.Refers(f) || _r.Refers(f);
+			}
+			// C = A*B + beta*C, C is Rows() x Cols() with leading dimension ldc
+			void Evaluate(Compute *C, size_t ldc, Compute beta) const {
+				if constexpr (std::is_same<typename L::Number, Compute>::value) {
+					Autotuner::Instance().Gemm<Compute>(Rows(), Cols(), _l.Cols(), 1, _l.Data(), _l.RowStride(), _l.ColStride(), _r.Data(), _r.RowStride(), _r.ColStride(), beta, C, ldc);
+				} else { // GEMM takes A in the compute type
+					const Matrix<Compute, Compute> left(_l);
+					Autotuner::Instance().Gemm<Compute>(Rows(), Cols(), _l.Cols(), 1, left.Data(), left.Cols(), 1, _r.Data(), _r.RowStride(), _r.ColStride(), beta, C, ldc);
+				}
+			}
+		private:
+			const Matrix<Compute, Compute> &_value() const {
+				if (nullptr == _cache) {
+					_cache = std::make_shared<Matrix<Compute, Compute>>(Rows(), Cols());
+					Evaluate(_cache->Data(), Cols(), 0);
+				}
+				return *_cache;
+			}
+
+			typename ExpressionStorage<L>::Type _l;
+			typename ExpressionStorage<R>::Type _r;
+			mutable std::shared_ptr<Matrix<Compute, Compute>> _cache;
+	};
+
+	// element-wise L op R, R may be a 1 x Cols() row added to every row of L
+	template <class OP, class L, class R> class Binary: public Expression<Binary<OP, L, R>> {
+		public:
+			using Compute = typename L::Compute;
+			Binary(const L &l, const R &r)
+				: _l(l)
+				, _r(r) {
+				if ((_l.Cols() != _r.Cols()) || ((_l.Rows() != _r.Rows()) && (1 != _r.Rows()))) {
+					throw std::runtime_error("Matrix +/- Matrix size mismatch");
+				}
+			}
+			size_t Rows() const {
+				return _l.Rows();
+			}
+			size_t Cols() const {
+				return _l.Cols();
+			}
+			Compute Get(size_t r, size_t c) const {
+				return OP::Apply(_l.Get(r, c), _r.Get((1 == _r.Rows()) ? 0 : r, c));
+			}
+			bool Linear() const {
+				return _l.Linear() && _r.Linear() && (_l.Rows() == _r.Rows());
+			}
+			Compute Get(size_t i) const {
+				return OP::Apply(_l.Get(i), _r.Get(i));
+			}
+			bool Refers(const Footprint &f) const {
+				return _l.Refers(f) || _r.Refers(f);
+			}
+			bool Aliases(const Footprint &f) const {
+				return _l.Aliases(f) || _r.Aliases(f) || ((_l.Rows() != _r.Rows()) && _r.Refers(f));
+			}
+			const L &Left() const {
+				return _l;
+			}
+			const R &Right() const {
+				return _r;
+			}
+		private:
+			typename ExpressionStorage<L>::Type _l;
+			typename ExpressionStorage<R>::Type _r;
+	};
+
+	// dst = e (+ dst if ACCUMULATE), dst is a matrix or a view of the expression's size not aliased by it
+	template <bool ACCUMULATE, class D, class E> void Evaluate(D &dst, const E &e) {
+		using NUMBER = typename D::Number;
+		using COMPUTE = typename E::Compute;
+		NUMBER *d = dst.Data();
+		const size_t rows = e.Rows();
+		const size_t cols = e.Cols();
+		const size_t rs = dst.RowStride();
+		const size_t cs = dst.ColStride();
+		if ((1 == cs) && (cols == rs) && e.Linear()) {
+			const size_t n = rows*cols;
+			LINALG_PRAGMA_SIMD
+			for (size_t i = 0; i < n; ++i) {
+				d[i] = NUMBER(ACCUMULATE ? COMPUTE(d[i]) + e.Get(i) : e.Get(i));
+			}
+		} else {
+			for (size_t r = 0; r < rows; ++r) {
+				for (size_t c = 0; c < cols; ++c) {
+					NUMBER &v = d[r*rs + c*cs];
+					v = NUMBER(ACCUMULATE ? COMPUTE(v) + e.Get(r, c) : e.Get(r, c));
+				}
+			}
+		}
+	}
+	// GEMM straight into a destination with contiguous rows
+	template <bool ACCUMULATE, class D, class L, class R> void Evaluate(D &dst, const Product<L, R> &e) {
+		using COMPUTE = typename L::Compute;
+		if constexpr (std::is_same<typename D::Number, COMPUTE>::value) {
+			if (1 == dst.ColStride()) {
+				e.Evaluate(dst.Data(), dst.RowStride(), ACCUMULATE ? 1 : 0);
+				return;
+			}
+		}
+		Matrix<COMPUTE, COMPUTE> tmp(e.Rows(), e.Cols());
+		e.Evaluate(tmp.Data(), tmp.Cols(), 0);
+		Evaluate<ACCUMULATE>(dst, tmp);
+	}
+	// A*B + C: the destination takes C (or adds it), then one GEMM accumulates the product
+	template <bool ACCUMULATE, class D, class L, class R, class E> void Evaluate(D &dst, const Binary<Plus, Product<L, R>, E> &e) {
+		using COMPUTE = typename L::Compute;
+		const E &addend = e.Right();
+		if constexpr (std::is_same<typename D::Number, COMPUTE>::value) {
+			if (1 == dst.ColStride()) {
+				if (addend.Rows() == dst.Rows()) {
+					Evaluate<ACCUMULATE>(dst, addend);
+				} else { // a row for every row
+					COMPUTE *d = dst.Data();
+					const size_t cols = dst.Cols();
+					for (size_t r = 0; r < dst.Rows(); ++r) {
+						COMPUTE *dr = d + r*dst.RowStride();
+						LINALG_PRAGMA_SIMD
+						for (size_t c = 0; c < cols; ++c) {
+							dr[c] = (ACCUMULATE ? dr[c] : COMPUTE(0)) + addend.Get(0, c);
+						}
+					}
+				}
+				e.Left().Evaluate(dst.Data(), dst.RowStride(), 1);
+				return;
+			}
+		}
+		const Matrix<COMPUTE, COMPUTE> product(e.Left());
+		Evaluate<ACCUMULATE>(dst, Binary<Plus, Matrix<COMPUTE, COMPUTE>, E>(product, addend));
+	}
+
+	template <class L, class R> Binary<Plus, L, R> operator + (const Expression<L> &l, const Expression<R> &r) {
+		return Binary<Plus, L, R>(l.Derived(), r.Derived());
+	}
+	template <class L, class R> Binary<Minus, L, R> operator - (const Expression<L> &l, const Expression<R> &r) {
+		return Binary<Minus, L, R>(l.Derived(), r.Derived());
+	}
+	template <class L, class R> Product<L, R> operator * (const Expression<L> &l, const Expression<R> &r) {
+		return Product<L, R>(l.Derived(), r.Derived());
+	}
+	template <class E> Scaled<E> operator * (typename E::Compute k, const Expression<E> &e) {
+		return Scaled<E>(k, e.Derived());
+	}
+	template <class E> Scaled<E> operator * (const Expression<E> &e, typename E::Compute k) {
+		return Scaled<E>(k, e.Derived());
+	}
+}
+
+#endif
@@ -0,0 +1,53 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_GEMM_HPP
+#define LINALG_GEMM_HPP
+
+#include "linalg/allocator.hpp"
+#include "linalg/isa.hpp"
+#include "linalg/simd.hpp"
+#include "linalg/threadpool.hpp"
+#include "profile/profiler.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+/*
+	General matrix multiplication C = alpha*A*B + beta*C.
+	A is MxK, B is KxN, both addressed by row and column strides (so transposed
+	operands cost nothing), C is row-major MxN with leading dimension ldc.
+	The driver follows the usual packed-panel scheme: a KCxNC block of B is packed
+	into NR-wide panels, an MCxKC block of A into MR-high panels, and the MRxNR
+	register tile is computed by the micro-kernel.
+	1xN products (row vector by matrix) go to the GEMV path which streams B once.
+	B may be stored in a compact type (e.g. bf16, linalg/half.hpp) converting to NUMBER,
+	it is converted while packed or streamed and products are accumulated in NUMBER.
+	Kernels (linalg/gemmkernels.hpp) are built for every instruction set of linalg/isa.hpp,
+	blocking follows the register width of the set; functions below call the active one.
+*/
+#define LINALG_KERNELS "linalg/gemmkernels.hpp"
+#include "linalg/multiversion.hpp"
+#undef LINALG_KERNELS
+
+namespace LinAlg {
+	namespace Gemm {
+		template <class NUMBER, class TB = NUMBER> void Gemm(size_t M, size_t N, size_t K, NUMBER alpha, const NUMBER *A, size_t rsa, size_t csa, const TB *B, size_t rsb, size_t csb, NUMBER beta, NUMBER *C, size_t ldc, bool parallel=false) {
+			LINALG_DISPATCH(Gemm::Gemm<NUMBER, TB>(M, N, K, alpha, A, rsa, csa, B, rsb, csb, beta, C, ldc, parallel));
+		}
+		// Reference triple loop without packing, it wins for tiny shapes where packing does not pay off.
+		template <class NUMBER, class TB = NUMBER> void Naive(size_t M, size_t N, size_t K, NUMBER alpha, const NUMBER *A, size_t rsa, size_t csa, const TB *B, size_t rsb, size_t csb, NUMBER beta, NUMBER *C, size_t ldc, bool parallel=false) {
+			LINALG_DISPATCH(Gemm::Naive<NUMBER, TB>(M, N, K, alpha, A, rsa, csa, B, rsb, csb, beta, C, ldc, parallel));
+		}
+		// y = alpha * x * B + beta * y, x is 1xK with stride incx, B is KxN, y is contiguous 1xN
+		template <class NUMBER, class TB = NUMBER> void Gemv(size_t N, size_t K, NUMBER alpha, const NUMBER *x, size_t incx, const TB *B, size_t rsb, size_t csb, NUMBER beta, NUMBER *y, bool parallel=false) {
+			LINALG_DISPATCH(Gemm::Gemv<NUMBER, TB>(N, K, alpha, x, incx, B, rsb, csb, beta, y, parallel));
+		}
+		// y[i] = dot(W[i,:], e) with W taken before the update, and W[i,:] += x[i] * g, y may be null
+		template <class NUMBER> void GemvGer(size_t rows, size_t cols, NUMBER *W, size_t ldw, const NUMBER *e, NUMBER *y, const NUMBER *x, const NUMBER *g, bool parallel=false) {
+			LINALG_DISPATCH(Gemm::GemvGer<NUMBER>(rows, cols, W, ldw, e, y, x, g, parallel));
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,278 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+// GEMM kernels of one instruction set, included by linalg/gemm.hpp via linalg/multiversion.hpp
+namespace LinAlg {
+	namespace LINALG_ISA {
+		namespace Gemm {
+			template <class NUMBER> struct Blocking;
+			template <> struct Blocking<float> {
+#if LINALG_VECTOR_BITS >= 512
+				static constexpr size_t MR = 6;
+				static constexpr size_t NR = 32;
+#elif LINALG_VECTOR_BITS >= 256
+				static constexpr size_t MR = 6;
+				static constexpr size_t NR = 16;
+#else
+				static constexpr size_t MR = 4;
+				static constexpr size_t NR = 8;
+#endif
+				static constexpr size_t MC = 120;
+				static constexpr size_t KC = 256;
+				static constexpr size_t NC = 4096;
+				static constexpr size_t GEMV_CHUNK = 512;
+			};
+			template <> struct Blocking<double> {
+#if LINALG_VECTOR_BITS >= 512
+				static constexpr size_t MR = 6;
+				static constexpr size_t NR = 16;
+#elif LINALG_VECTOR_BITS >= 256
+				static constexpr size_t MR = 6;
+				static constexpr size_t NR = 8;
+#else
+				static constexpr size_t MR = 4;
+				static constexpr size_t NR = 4;
+#endif
+				static constexpr size_t MC = 120;
+				static constexpr size_t KC = 128;
+				static constexpr size_t NC = 2048;
+				static constexpr size_t GEMV_CHUNK = 256;
+			};
+
+			template <class NUMBER> void PackA(size_t mc, size_t kc, const NUMBER *a, size_t rsa, size_t csa, NUMBER *buf) {
+				constexpr size_t MR = Blocking<NUMBER>::MR;
+				for (size_t i0 = 0; i0 < mc; i0 += MR) {
+					size_t m = std::min(MR, mc - i0);
+					for (size_t p = 0; p < kc; ++p) {
+						for (size_t i = 0; i < MR; ++i) {
+							*buf++ = (i < m) ? a[(i0 + i)*rsa + p*csa] : NUMBER(0);
+						}
+					}
+				}
+			}
+
+			template <class NUMBER, class TB> void PackB(size_t kc, size_t nc, const TB *b, size_t rsb, size_t csb, NUMBER *buf) {
+				constexpr size_t NR = Blocking<NUMBER>::NR;
+				for (size_t j0 = 0; j0 < nc; j0 += NR) {
+					size_t n = std::min(NR, nc - j0);
+					for (size_t p = 0; p < kc; ++p) {
+						const TB *src = b + p*rsb + j0*csb;
+						if ((1 == csb) && (NR == n)) {
+							std::copy(src, src + NR, buf);
+						} else {
+							for (size_t j = 0; j < NR; ++j) {
+								buf[j] = (j < n) ? NUMBER(src[j*csb]) : NUMBER(0);
+							}
+						}
+						buf += NR;
+					}
+				}
+			}
+
+			// computes MRxNR tile from packed panels, stores the valid m x n part of it to C
+			template <class NUMBER> inline void MicroKernel(size_t kc, const NUMBER *a, const NUMBER *b, NUMBER alpha, NUMBER beta, NUMBER *c, size_t ldc, size_t m, size_t n) {
+				constexpr size_t MR = Blocking<NUMBER>::MR;
+				constexpr size_t NR = Blocking<NUMBER>::NR;
+				NUMBER acc[MR][NR] = {};
+				for (size_t p = 0; p < kc; ++p) {
+					for (size_t i = 0; i < MR; ++i) {
+						const NUMBER ai = a[i];
+						LINALG_PRAGMA_SIMD
+						for (size_t j = 0; j < NR; ++j) {
+							acc[i][j] += ai*b[j];
+						}
+					}
+					a += MR;
+					b += NR;
+				}
+				for (size_t i = 0; i < m; ++i) {
+					NUMBER *ci = c + i*ldc;
+					if (NUMBER(0) == beta) {
+						for (size_t j = 0; j < n; ++j) {
+							ci[j] = alpha*acc[i][j];
+						}
+					} else {
+						for (size_t j = 0; j < n; ++j) {
+							ci[j] = beta*ci[j] + alpha*acc[i][j];
+						}
+					}
+				}
+			}
+
+			template <class NUMBER> void Scale(size_t M, size_t N, NUMBER beta, NUMBER *C, size_t ldc) {
+				for (size_t i = 0; i < M; ++i) {
+					NUMBER *ci = C + i*ldc;
+					for (size_t j = 0; j < N; ++j) {
+						ci[j] = (NUMBER(0) == beta) ? NUMBER(0) : beta*ci[j];
+					}
+				}
+			}
+
+			// y = alpha * x * B + beta * y, x is 1xK with stride incx, B is KxN, y is contiguous 1xN
+			template <class NUMBER, class TB = NUMBER> void Gemv(size_t N, size_t K, NUMBER alpha, const NUMBER *x, size_t incx, const TB *B, size_t rsb, size_t csb, NUMBER beta, NUMBER *y, bool parallel=false) {
+				PROFILE_SCOPE(Gemv, -1, 2*N*K, N*K*sizeof(TB) + (K + 2*N)*sizeof(NUMBER));
+				if (1 == csb) { // rows of B are contiguous: y += x[k] * B[k,:], B is streamed once
+					constexpr size_t CHUNK = Blocking<NUMBER>::GEMV_CHUNK;
+					const size_t chunks = (N + CHUNK - 1)/CHUNK;
+					ThreadPool::Current().ParallelFor(chunks, [&](size_t begin, size_t end) {
+						for (size_t ch = begin; ch < end; ++ch) {
+							size_t j0 = ch*CHUNK;
+							size_t n = std::min(CHUNK, N - j0);
+							NUMBER *yc = y + j0;
+							if (NUMBER(0) == beta) {
+								std::fill(yc, yc + n, NUMBER(0));
+							} else if (NUMBER(1) != beta) {
+								for (size_t j = 0; j < n; ++j) {
+									yc[j] *= beta;
+								}
+							}
+							for (size_t k = 0; k < K; ++k) {
+								const NUMBER xk = alpha*x[k*incx];
+								const TB *bk = B + k*rsb + j0;
+								LINALG_PRAGMA_SIMD
+								for (size_t j = 0; j < n; ++j) {
+									yc[j] += xk*NUMBER(bk[j]);
+								}
+							}
+						}
+					}, parallel);
+				} else { // columns of B are strided by rsb: y[j] = dot(x, B[:,j])
+					ThreadPool::Current().ParallelFor(N, [&](size_t begin, size_t end) {
+						for (size_t j = begin; j < end; ++j) {
+							const TB *bj = B + j*csb;
+							NUMBER sum = 0;
+							if ((1 == rsb) && (1 == incx)) {
+								LINALG_PRAGMA_SIMD_REDUCTION(+, sum)
+								for (size_t k = 0; k < K; ++k) {
+									sum += x[k]*NUMBER(bj[k]);
+								}
+							} else {
+								for (size_t k = 0; k < K; ++k) {
+									sum += x[k*incx]*NUMBER(bj[k*rsb]);
+								}
+							}
+							y[j] = ((NUMBER(0) == beta) ? NUMBER(0) : beta*y[j]) + alpha*sum;
+						}
+					}, parallel);
+				}
+			}
+
+			// Fused level-2 step of the backward pass over row-major W (rows x cols):
+			// y[i] = dot(W[i,:], e) with W taken before the update, and W[i,:] += x[i] * g.
+			// Every row of W is read and written once. y may be null if it is not needed.
+			template <class NUMBER> void GemvGer(size_t rows, size_t cols, NUMBER *W, size_t ldw, const NUMBER *e, NUMBER *y, const NUMBER *x, const NUMBER *g, bool parallel=false) {
+				if (nullptr != y) {
+					ThreadPool::Current().ParallelFor(rows, [&](size_t begin, size_t end) {
+						for (size_t i = begin; i < end; ++i) {
+							NUMBER *wi = W + i*ldw;
+							const NUMBER xi = x[i];
+							NUMBER sum = 0;
+							LINALG_PRAGMA_SIMD_REDUCTION(+, sum)
+							for (size_t j = 0; j < cols; ++j) {
+								sum += wi[j]*e[j];
+								wi[j] += xi*g[j];
+							}
+							y[i] = sum;
+						}
+					}, parallel);
+				} else {
+					ThreadPool::Current().ParallelFor(rows, [&](size_t begin, size_t end) {
+						for (size_t i = begin; i < end; ++i) {
+							NUMBER *wi = W + i*ldw;
+							const NUMBER xi = x[i];
+							LINALG_PRAGMA_SIMD
+							for (size_t j = 0; j < cols; ++j) {
+								wi[j] += xi*g[j];
+							}
+						}
+					}, parallel);
+				}
+			}
+
+			// Reference triple loop without packing, rows of C are computed independently.
+			// It wins for tiny shapes where packing does not pay off.
+			template <class NUMBER, class TB = NUMBER> void Naive(size_t M, size_t N, size_t K, NUMBER alpha, const NUMBER *A, size_t rsa, size_t csa, const TB *B, size_t rsb, size_t csb, NUMBER beta, NUMBER *C, size_t ldc, bool parallel=false) {
+				PROFILE_SCOPE(Gemm, -1, 2*M*N*K, K*N*sizeof(TB) + (M*K + 2*M*N)*sizeof(NUMBER));
+				ThreadPool::Current().ParallelFor(M, [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						NUMBER *ci = C + i*ldc;
+						for (size_t j = 0; j < N; ++j) {
+							ci[j] = (NUMBER(0) == beta) ? NUMBER(0) : beta*ci[j];
+						}
+						for (size_t k = 0; k < K; ++k) {
+							const NUMBER aik = alpha*A[i*rsa + k*csa];
+							const TB *bk = B + k*rsb;
+							if (1 == csb) {
+								LINALG_PRAGMA_SIMD
+								for (size_t j = 0; j < N; ++j) {
+									ci[j] += aik*NUMBER(bk[j]);
+								}
+							} else {
+								for (size_t j = 0; j < N; ++j) {
+									ci[j] += aik*NUMBER(bk[j*csb]);
+								}
+							}
+						}
+					}
+				}, parallel);
+			}
+
+			template <class NUMBER, class TB = NUMBER> void Gemm(size_t M, size_t N, size_t K, NUMBER alpha, const NUMBER *A, size_t rsa, size_t csa, const TB *B, size_t rsb, size_t csb, NUMBER beta, NUMBER *C, size_t ldc, bool parallel=false) {
+				using BL = Blocking<NUMBER>;
+				constexpr size_t MR = BL::MR;
+				constexpr size_t NR = BL::NR;
+				do {
+					if ((0 == M) || (0 == N)) {
+						break;
+					}
+					if (0 == K) {
+						Scale(M, N, beta, C, ldc);
+						break;
+					}
+					if (1 == M) {
+						Gemv(N, K, alpha, A, csa, B, rsb, csb, beta, C, parallel);
+						break;
+					}
+					PROFILE_SCOPE(Gemm, -1, 2*M*N*K, K*N*sizeof(TB) + (M*K + 2*M*N)*sizeof(NUMBER));
+					// packing buffers live per thread and only grow, so steady state does not allocate
+					thread_local std::vector<NUMBER, Allocator<NUMBER>> bufA;
+					thread_local std::vector<NUMBER, Allocator<NUMBER>> bufB;
+					const size_t ncMax = std::min(BL::NC, (N + NR - 1)/NR*NR);
+					const size_t kcMax = std::min(BL::KC, K);
+					const size_t mcMax = std::min(BL::MC, (M + MR - 1)/MR*MR);
+					if (bufA.size() < mcMax*kcMax) {
+						bufA.resize(mcMax*kcMax);
+					}
+					if (bufB.size() < ncMax*kcMax) {
+						bufB.resize(ncMax*kcMax);
+					}
+					NUMBER *pa = bufA.data();
+					NUMBER *pb = bufB.data();
+					for (size_t jc = 0; jc < N; jc += BL::NC) {
+						const size_t nc = std::min(BL::NC, N - jc);
+						for (size_t pc = 0; pc < K; pc += BL::KC) {
+							const size_t kc = std::min(BL::KC, K - pc);
+							const NUMBER betaBlock = (0 == pc) ? beta : NUMBER(1);
+							PackB(kc, nc, B + pc*rsb + jc*csb, rsb, csb, pb);
+							for (size_t ic = 0; ic < M; ic += BL::MC) {
+								const size_t mc = std::min(BL::MC, M - ic);
+								PackA(mc, kc, A + ic*rsa + pc*csa, rsa, csa, pa);
+								const size_t panels = (nc + NR - 1)/NR;
+								ThreadPool::Current().ParallelFor(panels, [&](size_t begin, size_t end) {
+									for (size_t jp = begin; jp < end; ++jp) {
+										const size_t jr = jp*NR;
+										const size_t n = std::min(NR, nc - jr);
+										for (size_t ir = 0; ir < mc; ir += MR) {
+											const size_t m = std::min(MR, mc - ir);
+											MicroKernel(kc, pa + ir*kc, pb + jr*kc, alpha, betaBlock, C + (ic + ir)*ldc + jc + jr, ldc, m, n);
+										}
+									}
+								}, parallel);
+							}
+						}
+					}
+				} while (false);
+			}
+		}
+	}
+}
@@ -0,0 +1,116 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_HALF_HPP
+#define LINALG_HALF_HPP
+
+#include "linalg/isa.hpp"
+#include "linalg/simd.hpp"
+#include "linalg/threadpool.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#ifdef __F16C__
+	#include <immintrin.h>
+#endif
+
+/*
+	16-bit storage types for weights: bf16 (8-bit exponent, 7-bit mantissa, the upper
+	half of float) and fp16 (IEEE 754 binary16). They are storage only, arithmetic is done
+	in float: both convert implicitly to float, so kernels written for NUMBER operands
+	accept them as a compact source and accumulate in the compute type.
+	Conversion from float rounds to nearest even. Array conversions are built per
+	instruction set (linalg/isa.hpp), the F16C path of fp16 is taken when the build targets it.
+*/
+namespace LinAlg {
+	inline uint32_t FloatBits(float f) {
+		uint32_t u;
+		std::memcpy(&u, &f, sizeof(u));
+		return u;
+	}
+	inline float BitsFloat(uint32_t u) {
+		float f;
+		std::memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+
+	struct bf16 {
+		uint16_t bits;
+
+		bf16() = default;
+		explicit bf16(float f) {
+			const uint32_t u = FloatBits(f);
+			const uint32_t rounded = (u + 0x7FFFu + ((u >> 16) & 1u)) >> 16;
+			bits = ((u & 0x7FFFFFFFu) > 0x7F800000u) ? uint16_t((u >> 16) | 0x40u) : uint16_t(rounded); // NaN stays quiet NaN
+		}
+		operator float() const {
+			return BitsFloat(uint32_t(bits) << 16);
+		}
+	};
+
+	struct fp16 {
+		uint16_t bits;
+
+		fp16() = default;
+		explicit fp16(float f) {
+#ifdef __F16C__
+			bits = _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+			const uint32_t F16_MAX = (127 + 16) << 23; // 2^16, the first value out of range
+			const uint32_t F16_NORMAL = 113 << 23; // 2^-14, the smallest normal fp16
+			const uint32_t DENORM_MAGIC = ((127 - 15) + (23 - 10) + 1) << 23;
+			uint32_t u = FloatBits(f);
+			const uint32_t sign = u & 0x80000000u;
+			u ^= sign;
+			uint32_t o;
+			if (u >= F16_MAX) { // overflow to infinity, NaN stays NaN
+				o = (u > 0x7F800000u) ? 0x7E00u : 0x7C00u;
+			} else if (u < F16_NORMAL) { // subnormal: let float addition do the rounding
+				o = FloatBits(BitsFloat(u) + BitsFloat(DENORM_MAGIC)) - DENORM_MAGIC;
+			} else {
+				const uint32_t odd = (u >> 13) & 1u;
+				u += (uint32_t(15 - 127) << 23) + 0xFFFu + odd;
+				o = u >> 13;
+			}
+			bits = uint16_t(o | (sign >> 16));
+#endif
+		}
+		operator float() const {
+#ifdef __F16C__
+			return _cvtsh_ss(bits);
+#else
+			const uint32_t sign = uint32_t(bits & 0x8000u) << 16;
+			const uint32_t exponent = (bits >> 10) & 0x1Fu;
+			const uint32_t mantissa = bits & 0x3FFu;
+			const uint32_t normal = sign | ((exponent + 112) << 23) | (mantissa << 13);
+			const uint32_t special = sign | 0x7F800000u | (mantissa << 13);
+			const uint32_t subnormal = sign | FloatBits(float(mantissa)*5.9604644775390625e-8f); // mantissa * 2^-24
+			return BitsFloat((0 == exponent) ? subnormal : ((0x1Fu == exponent) ? special : normal));
+#endif
+		}
+	};
+
+	// compute type of a storage type
+	template <class STORAGE> struct ComputeType {
+		using Type = STORAGE;
+	};
+	template <> struct ComputeType<bf16> {
+		using Type = float;
+	};
+	template <> struct ComputeType<fp16> {
+		using Type = float;
+	};
+}
+
+#define LINALG_KERNELS "linalg/halfkernels.hpp"
+#include "linalg/multiversion.hpp"
+#undef LINALG_KERNELS
+
+namespace LinAlg {
+	// dst[i] = TO(src[i]), e.g. float weights to their compact copy and back
+	template <class TO, class FROM> void Convert(const FROM *src, TO *dst, size_t n, bool parallel=false) {
+		LINALG_DISPATCH(Convert<TO, FROM>(src, dst, n, parallel));
+	}
+}
+
+#endif
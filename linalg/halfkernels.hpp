@@ -0,0 +1,17 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+// conversion kernels of one instruction set, included by linalg/half.hpp via linalg/multiversion.hpp
+namespace LinAlg {
+	namespace LINALG_ISA {
+		template <class TO, class FROM> void Convert(const FROM *src, TO *dst, size_t n, bool parallel=false) {
+			static constexpr size_t GRAIN = 1 << 14; // elements per chunk of a thread
+			ThreadPool::Current().ParallelFor(n, [&](size_t begin, size_t end) {
+				LINALG_PRAGMA_SIMD
+				for (size_t i = begin; i < end; ++i) {
+					dst[i] = TO(src[i]);
+				}
+			}, parallel, GRAIN);
+		}
+	}
+}
@@ -0,0 +1,122 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_ISA_HPP
+#define LINALG_ISA_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+/*
+	Runtime choice of the instruction set of kernels. Kernels are compiled once per instruction
+	set into namespaces Generic (the compiler's own target), Sse42, Avx2, Avx512 and Avx512Vnni
+	(see linalg/multiversion.hpp); their public entry points call the variant of ActiveIsa().
+	It is the best instruction set the CPU supports (cpuid) unless a lower one is requested
+	by the LINALG_ISA environment variable (generic, sse4.2, avx2, avx512, avx512vnni) or by
+	SelectIsa().
+	Variants are built by GCC for x86 only, other builds have the Generic one.
+*/
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+	#define LINALG_MULTIVERSION
+#endif
+
+#ifdef LINALG_MULTIVERSION
+	// calls Isa::CALL for the namespace Isa of the active instruction set, e.g.
+	// LINALG_DISPATCH(Gemm::Gemm<float>(...)) calls Avx2::Gemm::Gemm<float>(...) on AVX2
+	#define LINALG_DISPATCH(...) \
+		switch (LinAlg::ActiveIsa()) { \
+			case LinAlg::Isa::Avx512Vnni: \
+				Avx512Vnni::__VA_ARGS__; \
+				break; \
+			case LinAlg::Isa::Avx512: \
+				Avx512::__VA_ARGS__; \
+				break; \
+			case LinAlg::Isa::Avx2: \
+				Avx2::__VA_ARGS__; \
+				break; \
+			case LinAlg::Isa::Sse42: \
+				Sse42::__VA_ARGS__; \
+				break; \
+			default: \
+				Generic::__VA_ARGS__; \
+				break; \
+		}
+#else
+	#define LINALG_DISPATCH(...) Generic::__VA_ARGS__
+#endif
+
+namespace LinAlg {
+	enum class Isa : uint8_t {
+		Generic, // flags of the build
+		Sse42, // SSE4.2, POPCNT
+		Avx2, // AVX2, FMA
+		Avx512, // AVX-512 F, BW, DQ, VL
+		Avx512Vnni // and AVX-512 VNNI (int8 dot products)
+	};
+	static constexpr size_t ISA_COUNT = 5;
+
+	inline const char *IsaName(Isa isa) {
+		static const char *names[ISA_COUNT] = {"generic", "sse4.2", "avx2", "avx512", "avx512vnni"};
+		return names[size_t(isa)];
+	}
+	inline bool ParseIsa(const char *name, Isa &isa) {
+		bool res = false;
+		for (size_t i = 0; !res && (i < ISA_COUNT); ++i) {
+			if (0 == std::strcmp(name, IsaName(Isa(i)))) {
+				isa = Isa(i);
+				res = true;
+			}
+		}
+		return res;
+	}
+
+	// the best of the compiled instruction sets the CPU (and the OS) supports
+	inline Isa SupportedIsa() {
+		static const Isa supported = []() {
+			Isa res = Isa::Generic;
+#ifdef LINALG_MULTIVERSION
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")) {
+				res = __builtin_cpu_supports("avx512vnni") ? Isa::Avx512Vnni : Isa::Avx512;
+			} else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+				res = Isa::Avx2;
+			} else if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+				res = Isa::Sse42;
+			}
+#endif
+			return res;
+		}();
+		return supported;
+	}
+
+	inline std::atomic<Isa> &ActiveIsaStorage() {
+		static std::atomic<Isa> active([]() {
+			Isa res = SupportedIsa();
+			Isa requested;
+			const char *name = std::getenv("LINALG_ISA");
+			if ((nullptr != name) && ParseIsa(name, requested) && (requested < res)) {
+				res = requested;
+			}
+			return res;
+		}());
+		return active;
+	}
+	inline Isa ActiveIsa() {
+		return ActiveIsaStorage().load(std::memory_order_relaxed);
+	}
+	// Switches kernels of all threads, e.g. to compare variants. It is meant to be called
+	// between computations. Returns false if the instruction set is not supported.
+	inline bool SelectIsa(Isa isa) {
+		bool res = false;
+		if (isa <= SupportedIsa()) {
+			ActiveIsaStorage().store(isa, std::memory_order_relaxed);
+			res = true;
+		}
+		return res;
+	}
+}
+
+#endif
@@ -6,11 +6,17 @@
 
 #include "linalg/vector.hpp"
 #include "linalg/matrix.hpp"
+#include "linalg/sparse.hpp"
 
-template <class NUMBER> struct LinearAlgebra {
+// NUMBER is the storage type, COMPUTE the arithmetic one (float for bf16 and fp16 storage)
+template <class NUMBER, class COMPUTE = typename LinAlg::ComputeType<NUMBER>::Type> struct LinearAlgebra {
 	using Number = NUMBER;
+	using Compute = COMPUTE;
 	using Vector = LinAlg::Vector<Number>;
-	using Matrix = LinAlg::Matrix<Number>;
+	using Matrix = LinAlg::Matrix<Number, Compute>;
+	using MatrixView = LinAlg::MatrixView<Number, Compute>;
+	using ConstMatrixView = LinAlg::ConstMatrixView<Number, Compute>;
+	using SparseMatrix = LinAlg::SparseMatrix<Number>;
 };
 
 #endif
@@ -5,19 +5,41 @@
 #define LINALG_MATRIX_HPP
 
 #include "linalg/vector.hpp"
-#include <functional>
+#include "linalg/autotuner.hpp"
+#include "linalg/check.hpp"
+#include "linalg/expression.hpp"
+#include "linalg/gemm.hpp"
+#include "linalg/half.hpp"
+#include "linalg/threadpool.hpp"
+#include "linalg/view.hpp"
 #include <cstdint>
 #include <stdexcept>
-#ifdef _OPENMP
-	#include <omp.h>
-#endif
 #include <mutex>
+#include <type_traits>
 
 namespace LinAlg {
-	template <class NUMBER>class Matrix {
+	// NUMBER is the storage type of elements and COMPUTE is the type arithmetic is done in,
+	// e.g. Matrix<bf16, float> keeps half the bytes of Matrix<float> and multiplies in float
+	// +, -, scaling and products are lazy expressions (linalg/expression.hpp) evaluated
+	// straight into the matrix they are assigned to, Transp(), Block(), RowRange() etc. are
+	// views of its storage (linalg/view.hpp).
+	// Rows are RowStride() >= Cols() elements apart in 64-byte aligned storage. Matrices are
+	// dense by default, Resize(rows, cols, ALIGNED) pads rows to whole cache lines, so every
+	// row starts aligned, and later Resize(rows, cols) keep the padding.
+	// at() and operator[] check bounds only in LINALG_DEBUG builds, operator()(r, c) and
+	// RowData(r) are the unchecked accessors for kernels.
+	template <class NUMBER, class COMPUTE = typename ComputeType<NUMBER>::Type>class Matrix: public Expression<Matrix<NUMBER, COMPUTE>> {
 		public:
 			using Number = NUMBER;
+			using Compute = COMPUTE;
 			using Vector = LinAlg::Vector<Number>;
+			// leading dimension of Resize() padding rows to STORAGE_ALIGN
+			static constexpr size_t ALIGNED = ~size_t(0);
+			static size_t AlignedStride(size_t cols) {
+				const size_t line = (STORAGE_ALIGN % sizeof(Number)) ? 1 : STORAGE_ALIGN/sizeof(Number);
+				return (cols + line - 1)/line*line;
+			}
+
 			static Matrix Col(const Vector &v) {
 				Matrix res(v.size(), 1);
 				res._data = v;
@@ -39,224 +61,261 @@ namespace LinAlg {
 			Matrix()
 				:Matrix(0, 0) {
 			}
-			Matrix (size_t rows, size_t cols) {
+			Matrix (size_t rows, size_t cols)
+				: _aligned(false) {
 				Resize(rows, cols);
 			}
+			Matrix (size_t rows, size_t cols, size_t ld)
+				: _aligned(false) {
+				Resize(rows, cols, ld);
+			}
+			template <class E> Matrix(const Expression<E> &e)
+				:Matrix(0, 0) {
+				*this = e;
+			}
 			size_t Cols() const {
 				return _cols;
 			}
 			size_t Rows() const {
 				return _rows;
 			}
+			Number *Data() {
+				return _data.data();
+			}
+			const Number *Data() const {
+				return _data.data();
+			}
+			size_t RowStride() const {
+				return _ld;
+			}
+			size_t ColStride() const {
+				return 1;
+			}
+			// rows are not padded
+			bool Dense() const {
+				return _ld == _cols;
+			}
+			// keeps the padding of rows (none or ALIGNED)
 			Matrix &Resize(size_t rows, size_t cols) {
 				_rows = rows;
 				_cols = cols;
-				_data.resize(Rows()*Cols());
+				_ld = _aligned ? AlignedStride(cols) : cols;
+				_data.resize(Rows()*_ld);
+				return *this;
+			}
+			// ld is ALIGNED or a row stride of at least cols elements
+			Matrix &Resize(size_t rows, size_t cols, size_t ld) {
+				if ((ALIGNED != ld) && (ld < cols)) {
+					throw std::runtime_error("Leading dimension is less than the row");
+				}
+				_aligned = (ALIGNED == ld);
+				Resize(rows, cols);
+				if (!_aligned) {
+					_ld = ld;
+					_data.resize(Rows()*_ld);
+				}
+				return *this;
+			}
+
+			// element-wise conversion from a matrix of another storage type, reuses own storage
+			template <class OTHER, class OTHER_COMPUTE> Matrix &ConvertFrom(const Matrix<OTHER, OTHER_COMPUTE> &other, bool parallel=false) {
+				Resize(other.Rows(), other.Cols());
+				if (Dense() && other.Dense()) {
+					Convert<Number>(other.Data(), Data(), Rows()*Cols(), parallel);
+				} else {
+					for (size_t r = 0; r < Rows(); ++r) {
+						Convert<Number>(other.RowData(r), RowData(r), Cols());
+					}
+				}
 				return *this;
 			}
 
+			// unchecked access for kernels
+			NUMBER &operator ()(size_t r, size_t c) {
+				LINALG_CHECK((r < Rows()) && (c < Cols()), "Index Out Of Range");
+				return _data[r*_ld + c];
+			}
+			const NUMBER &operator ()(size_t r, size_t c) const {
+				LINALG_CHECK((r < Rows()) && (c < Cols()), "Index Out Of Range");
+				return _data[r*_ld + c];
+			}
+			Number *RowData(size_t r) {
+				return Data() + r*_ld;
+			}
+			const Number *RowData(size_t r) const {
+				return Data() + r*_ld;
+			}
+
 			Matrix &toCol() {
 				if (!IsRow()&&!IsCol()) {
 					throw std::runtime_error("Can't tell linear size of non-vector matrix");
 				}
-				Resize(Size(), 1);
+				_reshape(Size(), 1);
 				return *this;
 			}
 			Matrix &toRow() {
 				if (!IsRow()&&!IsCol()) {
 					throw std::runtime_error("Can't tell linear size of non-vector matrix");
 				}
-				Resize(1, Size());
+				_reshape(1, Size());
 				return *this;
 			}
 
-			void ApplyForEach(std::function<void(Number &)> for_each, bool parallel=false) {
-#ifdef _OPENMP
-				#pragma omp parallel for schedule(static) if (parallel)
-#endif
-				for (size_t i=0; i<_data.size(); ++i) {
-					for_each(_data[i]);
+			template <class FUNCTION> void ApplyForEach(FUNCTION &&for_each, bool parallel=false) {
+				if (Dense()) {
+					static constexpr size_t GRAIN = 1024; // elements per chunk of a thread
+					NUMBER *d = _data.data();
+					ThreadPool::Current().ParallelFor(_data.size(), [&](size_t begin, size_t end) {
+						for (size_t i=begin; i<end; ++i) {
+							for_each(d[i]);
+						}
+					}, parallel, GRAIN);
+				} else {
+					View().ApplyForEach(for_each, parallel);
 				}
 			}
 			NUMBER &at(size_t r, size_t c) {
-				if (r >= Rows()) {
-					throw std::runtime_error("Row Out Of Range");
-				}
-				if (c >= Cols()) {
-					throw std::runtime_error("Row Out Of Range");
-				}
-				return _data[r*_cols+c];
+				LINALG_CHECK(r < Rows(), "Row Out Of Range");
+				LINALG_CHECK(c < Cols(), "Col Out Of Range");
+				return _data[r*_ld+c];
 			}
 			const NUMBER &at(size_t r, size_t c) const {
-				if (r >= Rows()) {
-					throw std::runtime_error("Row Out Of Range");
-				}
-				if (c >= Cols()) {
-					throw std::runtime_error("Row Out Of Range");
-				}
-				return _data[r*_cols+c];
+				LINALG_CHECK(r < Rows(), "Row Out Of Range");
+				LINALG_CHECK(c < Cols(), "Col Out Of Range");
+				return _data[r*_ld+c];
 			}
 			Matrix &operator = (const Vector &other) {
 				if (!IsRow()&&!IsCol()) {
 					throw std::runtime_error("Can't assign vector to non-vector matrix");
 				}
-				_data = other;
-				return *this;
-			}
-			Matrix Transp() const {
-				Matrix res(Cols(), Rows());
-				for (size_t r=0; r<_rows; ++r) {
-					for (size_t c=0; c<_cols; ++c) {
-						res.at(c, r) = at(r, c);
+				if (Dense()) {
+					_data = other;
+				} else { // a padded column
+					for (size_t i = 0; i < other.size(); ++i) {
+						_data[_linear(i)] = other[i];
 					}
 				}
-				return res;
+				return *this;
 			}
-
-			struct Statistics {
-				Statistics() {
-					reset();
-				}
-				void reset() {
-#ifdef _OPENMP
-					Mul.l_barrier = 0;
-#else
-					Mul.p_barrier = std::numeric_limits<size_t>::max();
-#endif
-					Mul.p_barrier = std::numeric_limits<size_t>::max();
-				}
-				struct {
-					size_t l_barrier;
-					size_t p_barrier;
-				} Mul;
-			};
-			static inline Statistics Stat;
-
-			Matrix operator * (const Matrix &other) const {
-				if (Cols() != other.Rows()) {
-					throw std::runtime_error("Matrix * Matrix size mismatch");
-				}
-				Matrix res(Rows(), other.Cols());
-				size_t items = res._data.size();
-				do {
-#ifdef _OPENMP
-					using Clock = std::chrono::high_resolution_clock;
-					Clock clock;
-
-					if ((items > Stat.Mul.l_barrier) && (items < Stat.Mul.p_barrier)) { // надо замерить время
-						Clock::duration lin_time = Clock::duration::max();
-						if (true) { // последовательно считаем
-							auto start = clock.now();
-							for (size_t i = 0; i<items; ++i) {
-								size_t r = i/res._cols;
-								size_t c = i%res._cols;
-
-								res._data[i] = 0;
-								for (size_t t=0; t<_cols; ++t) {
-									res._data[i] += _data[r*_cols+t]*other._data[t*other._cols+c];
-								}
-							}
-							lin_time = clock.now() - start;
-						}
-						Clock::duration par_time = Clock::duration::max();
-						if (true) { // параллельно считаем
-							auto start = clock.now();
-							#pragma omp parallel for schedule (static)
-							for (size_t i = 0; i<items; ++i) {
-								size_t r = i/res._cols;
-								size_t c = i%res._cols;
-
-								res._data[i] = 0;
-								for (size_t t=0; t<_cols; ++t) {
-									res._data[i] += _data[r*_cols+t]*other._data[t*other._cols+c];
-								}
-							}
-							par_time = clock.now() - start;
-						}
-
-						if (par_time < lin_time) {
-							Stat.Mul.p_barrier = items;
-						} else if (lin_time < par_time) {
-							Stat.Mul.l_barrier = items;
-						}
-						break;
-					}
-					#pragma omp parallel for schedule (static) if (items >= Stat.Mul.p_barrier)
-#endif
-					for (size_t i = 0; i<items; ++i) {
-						size_t r = i/res._cols;
-						size_t c = i%res._cols;
-
-						res._data[i] = 0;
-						for (size_t t=0; t<_cols; ++t) {
-							res._data[i] += _data[r*_cols+t]*other._data[t*other._cols+c];
-						}
-					}
-				} while (false);
-				return res;
+			// O(1) views sharing the storage, valid until the matrix is resized
+			MatrixView<Number, Compute> View() {
+				return MatrixView<Number, Compute>(Data(), Rows(), Cols(), _ld, 1);
 			}
-			Matrix operator - (const Matrix &other) const {
-				if (Cols() != other.Cols()) {
-					throw std::runtime_error("Matrix - Matrix size mismatch");
-				}
-				if (Rows() != other.Rows()) {
-					throw std::runtime_error("Matrix - Matrix size mismatch");
-				}
-				Matrix res(Rows(), Cols());
-				for (size_t i = 0; i<_data.size(); ++i) {
-					res._data[i] = _data[i] - other._data[i];
-				}
-				return res;
+			ConstMatrixView<Number, Compute> View() const {
+				return ConstMatrixView<Number, Compute>(Data(), Rows(), Cols(), _ld, 1);
+			}
+			// an assignment of the transposed matrix to itself goes through a temporary
+			MatrixView<Number, Compute> Transp() {
+				return View().Transp();
+			}
+			ConstMatrixView<Number, Compute> Transp() const {
+				return View().Transp();
+			}
+			MatrixView<Number, Compute> Block(size_t r, size_t c, size_t rows, size_t cols) {
+				return View().Block(r, c, rows, cols);
+			}
+			ConstMatrixView<Number, Compute> Block(size_t r, size_t c, size_t rows, size_t cols) const {
+				return View().Block(r, c, rows, cols);
+			}
+			MatrixView<Number, Compute> RowRange(size_t begin, size_t end) {
+				return View().RowRange(begin, end);
+			}
+			ConstMatrixView<Number, Compute> RowRange(size_t begin, size_t end) const {
+				return View().RowRange(begin, end);
+			}
+			MatrixView<Number, Compute> RowAt(size_t r) {
+				return View().RowAt(r);
+			}
+			ConstMatrixView<Number, Compute> RowAt(size_t r) const {
+				return View().RowAt(r);
+			}
+			MatrixView<Number, Compute> ColAt(size_t c) {
+				return View().ColAt(c);
+			}
+			ConstMatrixView<Number, Compute> ColAt(size_t c) const {
+				return View().ColAt(c);
+			}
+			operator ConstMatrixView<Number, Compute>() const {
+				return View();
 			}
 
-			Matrix operator + (const Matrix &other) const {
-				if (Cols() != other.Cols()) {
-					throw std::runtime_error("Matrix - Matrix size mismatch");
+			// Evaluates the expression in one pass, products by GEMM (the kernel and the number of
+			// threads are chosen by the autotuner). Storage is reused when the size does not change,
+			// an expression reading this matrix at other positions is evaluated into a temporary.
+			template <class E> Matrix &operator = (const Expression<E> &e) {
+				const E &x = e.Derived();
+				const bool resized = (x.Rows() != Rows()) || (x.Cols() != Cols());
+				if (x.Aliases(Storage()) || (resized && x.Refers(Storage()))) {
+					Matrix tmp(x.Rows(), x.Cols(), _aligned ? ALIGNED : x.Cols());
+					Evaluate<false>(tmp, x);
+					*this = std::move(tmp);
+				} else {
+					Resize(x.Rows(), x.Cols());
+					Evaluate<false>(*this, x);
 				}
-				if (Rows() != other.Rows()) {
-					throw std::runtime_error("Matrix - Matrix size mismatch");
-				}
-				Matrix res(Rows(), Cols());
-				for (size_t i = 0; i<_data.size(); ++i) {
-					res._data[i] = _data[i] + other._data[i];
-				}
-				return res;
+				return *this;
 			}
-			void operator += (const Matrix &other) {
-				if (Cols() != other.Cols()) {
-					throw std::runtime_error("Matrixes sizes mismatch");
-				}
-				if (Rows() != other.Rows()) {
+			template <class E> Matrix &operator += (const Expression<E> &e) {
+				const E &x = e.Derived();
+				if ((Cols() != x.Cols()) || (Rows() != x.Rows())) {
 					throw std::runtime_error("Matrixes sizes mismatch");
 				}
-				for (size_t i = 0; i<_data.size(); ++i) {
-					_data[i] += other._data[i];
+				if (x.Aliases(Storage())) {
+					Evaluate<true>(*this, Matrix(x));
+				} else {
+					Evaluate<true>(*this, x);
 				}
+				return *this;
+			}
+
+			// element access of expression nodes
+			Compute Get(size_t r, size_t c) const {
+				return Compute(_data[r*_ld + c]);
+			}
+			bool Linear() const {
+				return Dense();
+			}
+			Compute Get(size_t i) const {
+				return Compute(_data[i]);
+			}
+			Footprint Storage() const {
+				return Footprint::Of(Data(), Rows(), Cols(), _ld, 1);
+			}
+			bool Refers(const Footprint &f) const {
+				return Storage().Overlaps(f);
+			}
+			bool Aliases(const Footprint &f) const {
+				return Refers(f) && !Storage().Same(f);
 			}
 			operator Vector() const {
 				if (!IsRow()&&!IsCol()) {
 					throw std::runtime_error("Can't convert non-vector matrix to vector");
 				}
-				return _data;
+				if (Dense()) {
+					return _data;
+				}
+				Vector res(Rows()*Cols());
+				for (size_t i = 0; i < res.size(); ++i) {
+					res[i] = _data[_linear(i)];
+				}
+				return res;
 			}
 
 			size_t Size() const {
 				if (!IsRow()&&!IsCol()) {
 					throw std::runtime_error("Can't tell linear size of non-vector matrix");
 				}
-				return _data.size();
+				return Rows()*Cols();
 			}
 			NUMBER &operator [](size_t i) {
-				if (!IsRow()&&!IsCol()) {
-					throw std::runtime_error("Can't access to non-vector matrix by linear index");
-				}
-				return _data[i];
+				LINALG_CHECK(IsRow() || IsCol(), "Can't access to non-vector matrix by linear index");
+				LINALG_CHECK(i < Rows()*Cols(), "Index Out Of Range");
+				return _data[_linear(i)];
 			}
 			const NUMBER &at(size_t i) const {
-				if (!IsRow()&&!IsCol()) {
-					throw std::runtime_error("Can't access to non-vector matrix by linear index");
-				}
-				return _data[i];
+				LINALG_CHECK(IsRow() || IsCol(), "Can't access to non-vector matrix by linear index");
+				LINALG_CHECK(i < Rows()*Cols(), "Index Out Of Range");
+				return _data[_linear(i)];
 			}
 
 			void Dump() {
@@ -266,7 +325,7 @@ namespace LinAlg {
 						if (0 != c) {
 							printf ("\t");
 						}
-						printf ("%0.02f", at(r, c));
+						printf ("%0.02f", double(Compute(at(r, c))));
 					}
 					if (r == Rows()-1) {
 						printf("]");
@@ -275,9 +334,6 @@ namespace LinAlg {
 				}
 			}
 
-			virtual ~Matrix() {
-			}
-
 			bool IsRow() const {
 				return 1 == Cols();
 			}
@@ -286,8 +342,25 @@ namespace LinAlg {
 			}
 
 		protected:
+			// storage index of the i-th element of a row or a column
+			size_t _linear(size_t i) const {
+				return (1 == _cols) ? i*_ld : i;
+			}
+			// the same elements as a dense rows x cols matrix
+			void _reshape(size_t rows, size_t cols) {
+				if (Dense()) {
+					Resize(rows, cols, cols);
+				} else {
+					const Vector v = *this;
+					Resize(rows, cols, cols);
+					_data = v;
+				}
+			}
+
 			size_t _rows;
 			size_t _cols;
+			size_t _ld; // row stride
+			bool _aligned; // Resize() pads rows to STORAGE_ALIGN
 			Vector _data;
 	};
 }
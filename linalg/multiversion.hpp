@@ -0,0 +1,91 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+/*
+	Includes the kernel file named by LINALG_KERNELS once per instruction set (linalg/isa.hpp).
+	The file has no include guard, it puts its code into namespace LINALG_ISA of its module
+	and takes the SIMD register width from LINALG_VECTOR_BITS and the availability of AVX2
+	and AVX-512 VNNI from LINALG_HAVE_AVX2 and LINALG_HAVE_VNNI (0 or 1), because the target
+	macros (__AVX2__ etc.) do not follow #pragma GCC target in C++. It must not include anything:
+	types it uses are defined with the build's flags before, so only the kernels themselves
+	(and inline functions they call) are compiled for the instruction set.
+*/
+#include "linalg/isa.hpp"
+
+#define LINALG_ISA Generic
+#if defined(__AVX512F__)
+	#define LINALG_VECTOR_BITS 512
+#elif defined(__AVX__)
+	#define LINALG_VECTOR_BITS 256
+#else
+	#define LINALG_VECTOR_BITS 128
+#endif
+#if defined(__AVX2__)
+	#define LINALG_HAVE_AVX2 1
+#else
+	#define LINALG_HAVE_AVX2 0
+#endif
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+	#define LINALG_HAVE_VNNI 1
+#else
+	#define LINALG_HAVE_VNNI 0
+#endif
+#include LINALG_KERNELS
+#undef LINALG_HAVE_VNNI
+#undef LINALG_HAVE_AVX2
+#undef LINALG_VECTOR_BITS
+#undef LINALG_ISA
+
+#ifdef LINALG_MULTIVERSION
+	#pragma GCC push_options
+	#pragma GCC target("sse4.2,popcnt")
+	#define LINALG_ISA Sse42
+	#define LINALG_VECTOR_BITS 128
+	#define LINALG_HAVE_AVX2 0
+	#define LINALG_HAVE_VNNI 0
+	#include LINALG_KERNELS
+	#undef LINALG_HAVE_VNNI
+	#undef LINALG_HAVE_AVX2
+	#undef LINALG_VECTOR_BITS
+	#undef LINALG_ISA
+	#pragma GCC pop_options
+
+	#pragma GCC push_options
+	#pragma GCC target("avx2,fma")
+	#define LINALG_ISA Avx2
+	#define LINALG_VECTOR_BITS 256
+	#define LINALG_HAVE_AVX2 1
+	#define LINALG_HAVE_VNNI 0
+	#include LINALG_KERNELS
+	#undef LINALG_HAVE_VNNI
+	#undef LINALG_HAVE_AVX2
+	#undef LINALG_VECTOR_BITS
+	#undef LINALG_ISA
+	#pragma GCC pop_options
+
+	#pragma GCC push_options
+	#pragma GCC target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma,prefer-vector-width=512")
+	#define LINALG_ISA Avx512
+	#define LINALG_VECTOR_BITS 512
+	#define LINALG_HAVE_AVX2 1
+	#define LINALG_HAVE_VNNI 0
+	#include LINALG_KERNELS
+	#undef LINALG_HAVE_VNNI
+	#undef LINALG_HAVE_AVX2
+	#undef LINALG_VECTOR_BITS
+	#undef LINALG_ISA
+	#pragma GCC pop_options
+
+	#pragma GCC push_options
+	#pragma GCC target("avx512f,avx512bw,avx512dq,avx512vl,avx512vnni,avx2,fma,prefer-vector-width=512")
+	#define LINALG_ISA Avx512Vnni
+	#define LINALG_VECTOR_BITS 512
+	#define LINALG_HAVE_AVX2 1
+	#define LINALG_HAVE_VNNI 1
+	#include LINALG_KERNELS
+	#undef LINALG_HAVE_VNNI
+	#undef LINALG_HAVE_AVX2
+	#undef LINALG_VECTOR_BITS
+	#undef LINALG_ISA
+	#pragma GCC pop_options
+#endif
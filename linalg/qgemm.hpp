@@ -0,0 +1,73 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_QGEMM_HPP
+#define LINALG_QGEMM_HPP
+
+#include "linalg/isa.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h> // all of the intrinsics, kernels of every instruction set use some
+#endif
+
+/*
+	Integer matrix multiplication C = A*B for quantized inference: A is MxK of uint8,
+	B is KxN of int8, C is MxN of int32 (exact, no saturation for K below 2^16).
+	B is packed once into NR-wide column panels where every group of KR consecutive
+	k of a column is adjacent, which is the operand layout of the dot-product
+	instructions (VPDPBUSD: 4 u8*s8 products added to every int32 lane).
+	Rows of A must be padded with any readable bytes up to PaddedK().
+	Without VNNI, AVX2 or SSE2 widen bytes to int16 and sum pairs of products by
+	(V)PMADDWD, which is exact as well. Kernels (linalg/qgemmkernels.hpp) are built for
+	every instruction set of linalg/isa.hpp, Gemm() calls the active one.
+*/
+namespace LinAlg {
+	namespace QGemm {
+		constexpr size_t NR = 16;
+		constexpr size_t KR = 4;
+		constexpr size_t MR = 4;
+
+		inline size_t PaddedK(size_t K) {
+			return (K + KR - 1)/KR*KR;
+		}
+		inline size_t PaddedN(size_t N) {
+			return (N + NR - 1)/NR*NR;
+		}
+		// size of packed B in bytes
+		inline size_t PackedSize(size_t K, size_t N) {
+			return PaddedK(K)*PaddedN(N);
+		}
+		// B is row-major KxN with leading dimension ldb, padding is filled by zeros
+		inline void PackB(size_t K, size_t N, const int8_t *B, size_t ldb, int8_t *packed) {
+			const size_t kp = PaddedK(K);
+			for (size_t j0 = 0; j0 < N; j0 += NR) {
+				for (size_t k0 = 0; k0 < kp; k0 += KR) {
+					for (size_t j = 0; j < NR; ++j) {
+						for (size_t t = 0; t < KR; ++t) {
+							const size_t k = k0 + t;
+							*packed++ = ((j0 + j < N) && (k < K)) ? B[k*ldb + j0 + j] : int8_t(0);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+#define LINALG_KERNELS "linalg/qgemmkernels.hpp"
+#include "linalg/multiversion.hpp"
+#undef LINALG_KERNELS
+
+namespace LinAlg {
+	namespace QGemm {
+		// C = A*B, A is MxK with rows of PaddedK() readable bytes lda apart, B packed by PackB
+		inline void Gemm(size_t M, size_t N, size_t K, const uint8_t *A, size_t lda, const int8_t *packed, int32_t *C, size_t ldc) {
+			LINALG_DISPATCH(QGemm::Gemm(M, N, K, A, lda, packed, C, ldc));
+		}
+	}
+}
+
+#endif
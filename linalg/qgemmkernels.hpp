@@ -0,0 +1,120 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+// int8 GEMM kernels of one instruction set, included by linalg/qgemm.hpp via linalg/multiversion.hpp
+namespace LinAlg {
+	namespace LINALG_ISA {
+		namespace QGemm {
+			using ::LinAlg::QGemm::NR;
+			using ::LinAlg::QGemm::KR;
+			using ::LinAlg::QGemm::MR;
+
+			// m (up to MR) rows of A by one packed panel, the valid n columns are stored to C
+			inline void Kernel(size_t m, size_t n, size_t kp, const uint8_t *A, size_t lda, const int8_t *panel, int32_t *C, size_t ldc) {
+#if LINALG_HAVE_VNNI
+				// VPDPBUSD: 4 u8*s8 products of a column added to its int32 lane
+				__m512i acc[MR];
+				for (size_t i = 0; i < MR; ++i) {
+					acc[i] = _mm512_setzero_si512();
+				}
+				for (size_t k0 = 0; k0 < kp; k0 += KR) {
+					const __m512i w = _mm512_loadu_si512(panel + k0*NR);
+					for (size_t i = 0; i < m; ++i) {
+						int32_t a;
+						std::memcpy(&a, A + i*lda + k0, sizeof(a));
+						acc[i] = _mm512_dpbusd_epi32(acc[i], _mm512_set1_epi32(a), w);
+					}
+				}
+				const __mmask16 mask = (NR == n) ? __mmask16(0xFFFF) : __mmask16((1u << n) - 1);
+				for (size_t i = 0; i < m; ++i) {
+					_mm512_mask_storeu_epi32(C + i*ldc, mask, acc[i]);
+				}
+#elif LINALG_HAVE_AVX2
+				// bytes widened to int16 and pairs of products summed by VPMADDWD (VPMADDUBSW
+				// would saturate: two products of 255*127 exceed int16)
+				for (size_t i = 0; i < m; ++i) {
+					__m256i acc[NR/4]; // pair sums: [j.01, j.23, j+1.01, j+1.23 | j+2.., j+3..] for columns j..j+3
+					for (size_t v = 0; v < NR/4; ++v) {
+						acc[v] = _mm256_setzero_si256();
+					}
+					for (size_t k0 = 0; k0 < kp; k0 += KR) {
+						int32_t a;
+						std::memcpy(&a, A + i*lda + k0, sizeof(a));
+						const __m256i a16 = _mm256_cvtepu8_epi16(_mm_set1_epi32(a)); // a0..a3 four times, zero extended
+						const int8_t *w = panel + k0*NR;
+						for (size_t q = 0; q < NR/4; ++q) {
+							const __m256i w16 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(w + q*16)));
+							acc[q] = _mm256_add_epi32(acc[q], _mm256_madd_epi16(w16, a16));
+						}
+					}
+					alignas(32) int32_t c[NR];
+					for (size_t q = 0; q < NR/4; q += 2) {
+						// lanes of the sums are [j, j+1, j+4, j+5 | j+2, j+3, j+6, j+7], 64-bit pairs reordered
+						const __m256i sums = _mm256_hadd_epi32(acc[q], acc[q + 1]);
+						_mm256_store_si256(reinterpret_cast<__m256i *>(c + q*4), _mm256_permute4x64_epi64(sums, _MM_SHUFFLE(3, 1, 2, 0)));
+					}
+					std::copy(c, c + n, C + i*ldc);
+				}
+#elif defined(__SSE2__)
+				// bytes widened to int16 and pairs of products summed by PMADDWD
+				const __m128i zero = _mm_setzero_si128();
+				for (size_t i = 0; i < m; ++i) {
+					__m128i acc[NR/2]; // pair sums: [j.01, j.23, j+1.01, j+1.23] for columns j, j+1
+					for (size_t v = 0; v < NR/2; ++v) {
+						acc[v] = zero;
+					}
+					for (size_t k0 = 0; k0 < kp; k0 += KR) {
+						int32_t a;
+						std::memcpy(&a, A + i*lda + k0, sizeof(a));
+						const __m128i a16 = _mm_unpacklo_epi8(_mm_set1_epi32(a), zero); // a0..a3 twice, zero extended
+						const int8_t *w = panel + k0*NR;
+						for (size_t q = 0; q < NR/4; ++q) {
+							const __m128i w8 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(w + q*16));
+							const __m128i sign = _mm_cmpgt_epi8(zero, w8);
+							acc[2*q] = _mm_add_epi32(acc[2*q], _mm_madd_epi16(_mm_unpacklo_epi8(w8, sign), a16));
+							acc[2*q + 1] = _mm_add_epi32(acc[2*q + 1], _mm_madd_epi16(_mm_unpackhi_epi8(w8, sign), a16));
+						}
+					}
+					alignas(16) int32_t c[NR];
+					for (size_t q = 0; q < NR/4; ++q) {
+						const __m128 x = _mm_castsi128_ps(acc[2*q]);
+						const __m128 y = _mm_castsi128_ps(acc[2*q + 1]);
+						const __m128i even = _mm_castps_si128(_mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0)));
+						const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(x, y, _MM_SHUFFLE(3, 1, 3, 1)));
+						_mm_store_si128(reinterpret_cast<__m128i *>(c + q*4), _mm_add_epi32(even, odd));
+					}
+					std::copy(c, c + n, C + i*ldc);
+				}
+#else
+				int32_t acc[MR][NR] = {};
+				for (size_t k0 = 0; k0 < kp; k0 += KR) {
+					const int8_t *w = panel + k0*NR;
+					for (size_t i = 0; i < m; ++i) {
+						const uint8_t *a = A + i*lda + k0;
+						for (size_t j = 0; j < NR; ++j) {
+							int32_t sum = 0;
+							for (size_t t = 0; t < KR; ++t) {
+								sum += int32_t(a[t])*int32_t(w[j*KR + t]);
+							}
+							acc[i][j] += sum;
+						}
+					}
+				}
+				for (size_t i = 0; i < m; ++i) {
+					std::copy(acc[i], acc[i] + n, C + i*ldc);
+				}
+#endif
+			}
+
+			inline void Gemm(size_t M, size_t N, size_t K, const uint8_t *A, size_t lda, const int8_t *packed, int32_t *C, size_t ldc) {
+				const size_t kp = ::LinAlg::QGemm::PaddedK(K);
+				for (size_t j0 = 0; j0 < N; j0 += NR) { // a panel stays in L1 while all rows pass it
+					for (size_t i0 = 0; i0 < M; i0 += MR) {
+						const size_t m = std::min(MR, M - i0);
+						Kernel(m, std::min(NR, N - j0), kp, A + i0*lda, lda, packed + j0*kp, C + i0*ldc + j0, ldc);
+					}
+				}
+			}
+		}
+	}
+}
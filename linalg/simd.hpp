@@ -0,0 +1,17 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_SIMD_HPP
+#define LINALG_SIMD_HPP
+
+// omp simd needs only -fopenmp-simd (LINALG_OPENMP_SIMD), not the OpenMP runtime
+#if defined(_OPENMP) || defined(LINALG_OPENMP_SIMD)
+	#define LINALG_PRAGMA_SIMD _Pragma("omp simd")
+	#define LINALG_PRAGMA_SIMD_REDUCTION(op, var) _Pragma(LINALG_STRINGIFY(omp simd reduction(op:var)))
+#else
+	#define LINALG_PRAGMA_SIMD
+	#define LINALG_PRAGMA_SIMD_REDUCTION(op, var)
+#endif
+#define LINALG_STRINGIFY(x) #x
+
+#endif
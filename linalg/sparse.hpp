@@ -0,0 +1,132 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_SPARSE_HPP
+#define LINALG_SPARSE_HPP
+
+#include "linalg/isa.hpp"
+#include "linalg/simd.hpp"
+#include "linalg/threadpool.hpp"
+#include "profile/profiler.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace LinAlg {
+	// Rows of (column index, value) pairs of nonzero elements (CSR). Row r holds pairs
+	// [Start()[r], Start()[r + 1]). Clear() keeps the capacity, so refilling does not allocate.
+	template <class NUMBER> class SparseMatrix {
+		public:
+			using Number = NUMBER;
+			SparseMatrix()
+				: _cols(0)
+				, _start(1, 0) {
+			}
+			size_t Rows() const {
+				return _start.size() - 1;
+			}
+			size_t Cols() const {
+				return _cols;
+			}
+			size_t NonZeros() const {
+				return _index.size();
+			}
+			// share of nonzero elements
+			double Density() const {
+				const size_t size = Rows()*Cols();
+				return (0 == size) ? 0 : double(NonZeros())/size;
+			}
+			const uint32_t *Start() const {
+				return _start.data();
+			}
+			const uint32_t *Index() const {
+				return _index.data();
+			}
+			const Number *Value() const {
+				return _value.data();
+			}
+
+			void Clear(size_t cols = 0) {
+				_cols = cols;
+				_start.resize(1);
+				_index.clear();
+				_value.clear();
+			}
+			// appends a row of n pairs, indices ascending and below Cols()
+			void AddRow(const uint32_t *index, const Number *value, size_t n) {
+				for (size_t i = 0; i < n; ++i) {
+					if ((index[i] >= _cols) || ((i > 0) && (index[i] <= index[i - 1]))) {
+						throw std::runtime_error("Sparse index out of order");
+					}
+				}
+				_index.insert(_index.end(), index, index + n);
+				_value.insert(_value.end(), value, value + n);
+				_start.push_back(_index.size());
+			}
+			void Reserve(size_t rows, size_t nonZeros) {
+				_start.reserve(rows + 1);
+				_index.reserve(nonZeros);
+				_value.reserve(nonZeros);
+			}
+			// Takes nonzeros of a dense rows x cols matrix with strides rs and cs. Gives up as soon
+			// as their share exceeds maxDensity: returns false and leaves the matrix without rows.
+			template <class T> bool Gather(const T *data, size_t rows, size_t cols, size_t rs, size_t cs, double maxDensity = 1) {
+				Clear(cols);
+				const size_t limit = size_t(maxDensity*rows*cols);
+				for (size_t r = 0; r < rows; ++r) {
+					const T *row = data + r*rs;
+					for (size_t c = 0; c < cols; ++c) {
+						const Number v = Number(row[c*cs]);
+						if (Number(0) != v) {
+							if (_index.size() == limit) {
+								Clear(cols);
+								return false;
+							}
+							_index.push_back(c);
+							_value.push_back(v);
+						}
+					}
+					_start.push_back(_index.size());
+				}
+				return true;
+			}
+			// zeroes Cols() elements of dense row r and sets its nonzeros
+			void ScatterRow(size_t r, Number *dense) const {
+				std::fill(dense, dense + _cols, Number(0));
+				for (uint32_t i = _start[r]; i < _start[r + 1]; ++i) {
+					dense[_index[i]] = _value[i];
+				}
+			}
+
+		private:
+			size_t _cols;
+			std::vector<uint32_t> _start;
+			std::vector<uint32_t> _index;
+			std::vector<Number> _value;
+	};
+}
+
+#define LINALG_KERNELS "linalg/sparsekernels.hpp"
+#include "linalg/multiversion.hpp"
+#undef LINALG_KERNELS
+
+namespace LinAlg {
+	// Kernels touch only rows of the dense operand matching nonzeros of the sparse one,
+	// they are built per instruction set (linalg/isa.hpp).
+	namespace Sparse {
+		// C += A * B: A is M x K sparse, B is K x N row-major (row stride ldb, converted from TB
+		// on load), C is M x N row-major. Every nonzero adds one row of B to a row of C.
+		template <class NUMBER, class TB = NUMBER> void Gemm(const SparseMatrix<NUMBER> &A, size_t N, const TB *B, size_t ldb, NUMBER *C, size_t ldc, bool parallel=false) {
+			LINALG_DISPATCH(Sparse::Gemm<NUMBER, TB>(A, N, B, ldb, C, ldc, parallel));
+		}
+		// W += A^T * G: A is M x K sparse, G is M x N row-major, W is K x N row-major.
+		// Only rows of W at nonzero columns of A are updated, threads take disjoint column blocks.
+		template <class NUMBER> void GemmT(const SparseMatrix<NUMBER> &A, size_t N, const NUMBER *G, size_t ldg, NUMBER *W, size_t ldw, bool parallel=false) {
+			LINALG_DISPATCH(Sparse::GemmT<NUMBER>(A, N, G, ldg, W, ldw, parallel));
+		}
+	}
+}
+
+#endif
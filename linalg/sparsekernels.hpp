@@ -0,0 +1,59 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+// sparse kernels of one instruction set, included by linalg/sparse.hpp via linalg/multiversion.hpp
+namespace LinAlg {
+	namespace LINALG_ISA {
+		namespace Sparse {
+			// every nonzero adds one row of B to a row of C
+			template <class NUMBER, class TB = NUMBER> void Gemm(const SparseMatrix<NUMBER> &A, size_t N, const TB *B, size_t ldb, NUMBER *C, size_t ldc, bool parallel=false) {
+				PROFILE_SCOPE(Sparse, -1, 2*A.NonZeros()*N, A.NonZeros()*(N*sizeof(TB) + sizeof(NUMBER) + sizeof(uint32_t)) + 2*A.Rows()*N*sizeof(NUMBER));
+				const uint32_t *start = A.Start();
+				const uint32_t *index = A.Index();
+				const NUMBER *value = A.Value();
+				const size_t m = A.Rows();
+				ThreadPool::Current().ParallelFor(m, [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						NUMBER *ci = C + i*ldc;
+						for (uint32_t p = start[i]; p < start[i + 1]; ++p) {
+							const TB *bk = B + size_t(index[p])*ldb;
+							const NUMBER v = value[p];
+							LINALG_PRAGMA_SIMD
+							for (size_t j = 0; j < N; ++j) {
+								ci[j] += v*NUMBER(bk[j]);
+							}
+						}
+					}
+				}, parallel);
+			}
+
+			// threads take disjoint column blocks of W, so the update is race-free and deterministic
+			template <class NUMBER> void GemmT(const SparseMatrix<NUMBER> &A, size_t N, const NUMBER *G, size_t ldg, NUMBER *W, size_t ldw, bool parallel=false) {
+				PROFILE_SCOPE(Sparse, -1, 2*A.NonZeros()*N, A.NonZeros()*(2*N*sizeof(NUMBER) + sizeof(NUMBER) + sizeof(uint32_t)) + A.Rows()*N*sizeof(NUMBER));
+				static constexpr size_t BLOCK = 64;
+				const uint32_t *start = A.Start();
+				const uint32_t *index = A.Index();
+				const NUMBER *value = A.Value();
+				const size_t m = A.Rows();
+				const size_t blocks = parallel ? (N + BLOCK - 1)/BLOCK : 1;
+				ThreadPool::Current().ParallelFor(blocks, [&](size_t begin, size_t end) {
+					for (size_t b = begin; b < end; ++b) {
+						const size_t from = parallel ? b*BLOCK : 0;
+						const size_t to = parallel ? std::min(N, from + BLOCK) : N;
+						for (size_t i = 0; i < m; ++i) {
+							const NUMBER *gi = G + i*ldg;
+							for (uint32_t p = start[i]; p < start[i + 1]; ++p) {
+								NUMBER *wk = W + size_t(index[p])*ldw;
+								const NUMBER v = value[p];
+								LINALG_PRAGMA_SIMD
+								for (size_t j = from; j < to; ++j) {
+									wk[j] += v*gi[j];
+								}
+							}
+						}
+					}
+				}, parallel);
+			}
+		}
+	}
+}
@@ -0,0 +1,343 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_THREADPOOL_HPP
+#define LINALG_THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#ifdef __linux__
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+#endif
+
+namespace LinAlg {
+	/*
+		Execution context of parallel kernels: persistent workers, the calling thread is
+		participant 0. ParallelFor(count, f) splits [0, count) into chunks of grain items,
+		every participant starts on its own contiguous share of chunks and, when it is done,
+		steals chunks from the shares of others, so uneven chunks do not leave threads idle.
+		Workers spin for a while after a job before they sleep, so back to back small kernels
+		do not pay for waking them. Nested calls (from a worker, or while another thread
+		runs a job) and calls of a single chunk run inline on the caller.
+		The thread count is set explicitly by SetThreads(), by default it is the number of
+		CPUs the process may run on. Workers may be pinned to CPUs: Compact takes CPUs in
+		order, Spread takes them evenly across the allowed set (e.g. across NUMA nodes).
+	*/
+	class ThreadPool {
+		public:
+			enum class Affinity : uint8_t {
+				None, // the OS schedules workers
+				Compact, // worker i on the i-th allowed CPU
+				Spread // workers evenly over the allowed CPUs
+			};
+			// Caps the participants of ParallelFor calls made by this thread while it lives.
+			// The pool runs one job at a time: a call made while another thread's job runs is
+			// done inline by its caller, so N threads calling at once (e.g. Predict() from many
+			// threads) get one pool between them, not N, and the rest of them run serially.
+			class Limit {
+				public:
+					Limit(size_t threads)
+						: _previous(_limit()) {
+						_limit() = threads;
+					}
+					~Limit() {
+						_limit() = _previous;
+					}
+					Limit(const Limit &) = delete;
+					Limit &operator = (const Limit &) = delete;
+
+				private:
+					size_t _previous;
+			};
+
+			// makes this thread's kernels run on pool while it lives
+			class Scope {
+				public:
+					Scope(ThreadPool &pool)
+						: _previous(_current()) {
+						_current() = &pool;
+					}
+					~Scope() {
+						_current() = _previous;
+					}
+					Scope(const Scope &) = delete;
+					Scope &operator = (const Scope &) = delete;
+
+				private:
+					ThreadPool *_previous;
+			};
+
+			// the shared pool
+			static ThreadPool &Instance() {
+				static ThreadPool pool;
+				return pool;
+			}
+			// the pool kernels of this thread run on: the one of the innermost Scope, the shared one otherwise
+			static ThreadPool &Current() {
+				return (nullptr != _current()) ? *_current() : Instance();
+			}
+			// A private pool, e.g. to keep benchmarks apart from the application's work.
+			// 0 threads is one per allowed CPU.
+			explicit ThreadPool(size_t threads, Affinity affinity = Affinity::None)
+				: _affinity(Affinity::None)
+				, _generation(0)
+				, _pending(0)
+				, _stopping(false)
+				, _failed(false) {
+				SetThreads(threads, affinity);
+			}
+			~ThreadPool() {
+				_stop();
+			}
+			ThreadPool(const ThreadPool &) = delete;
+			ThreadPool &operator = (const ThreadPool &) = delete;
+
+			// participants of a job, the calling thread included
+			size_t Threads() const {
+				return _workers.size() + 1;
+			}
+			Affinity GetAffinity() const {
+				return _affinity;
+			}
+			// CPUs the process may run on
+			static std::vector<int> AllowedCpus() {
+				std::vector<int> res;
+#ifdef __linux__
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				if (0 == sched_getaffinity(0, sizeof(set), &set)) {
+					for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+						if (CPU_ISSET(cpu, &set)) {
+							res.push_back(cpu);
+						}
+					}
+				}
+#endif
+				if (res.empty()) {
+					for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+						res.push_back(cpu);
+					}
+				}
+				return res;
+			}
+			// Restarts workers, meant to be called between computations. 0 threads is one per allowed CPU.
+			void SetThreads(size_t threads, Affinity affinity = Affinity::None) {
+				std::unique_lock<std::mutex> submit(_submit);
+				_stop();
+				const std::vector<int> cpus = AllowedCpus();
+				threads = (0 == threads) ? cpus.size() : threads;
+				_affinity = affinity;
+				_stopping = false;
+				_slots.reset(new Slot[threads]);
+				for (size_t i = 1; i < threads; ++i) {
+					int cpu = -1;
+					if (Affinity::Compact == affinity) {
+						cpu = cpus[i % cpus.size()];
+					} else if (Affinity::Spread == affinity) {
+						cpu = cpus[i*cpus.size()/threads % cpus.size()];
+					}
+					_workers.emplace_back(&ThreadPool::_loop, this, i, cpu);
+				}
+			}
+
+			// parallel calls of this thread that ran inline because the pool was busy or the thread is its worker
+			static size_t InlineRuns() {
+				return _inlineRuns();
+			}
+
+			// f(begin, end) for chunks of [0, count), in parallel if asked for and worth it
+			template <class FUNCTION> void ParallelFor(size_t count, FUNCTION &&f, bool parallel = true, size_t grain = 1) {
+				grain = std::max<size_t>(grain, 1);
+				const size_t chunks = (count + grain - 1)/grain;
+				const size_t limit = (0 == _limit()) ? Threads() : std::min(_limit(), Threads());
+				const size_t participants = std::min(limit, chunks);
+				std::unique_lock<std::mutex> submit(_submit, std::defer_lock);
+				// a nested call never touches _submit: its caller may be the thread holding it
+				if (!parallel || (participants < 2) || _isWorker() || _inJob() || !submit.try_lock()) {
+					if (parallel && (participants >= 2)) {
+						++_inlineRuns();
+					}
+					if (count > 0) {
+						f(size_t(0), count);
+					}
+					return;
+				}
+				_job.run = &ThreadPool::_invoke<typename std::remove_reference<FUNCTION>::type>;
+				_job.f = &f;
+				_job.count = count;
+				_job.grain = grain;
+				_job.participants = participants;
+				for (size_t i = 0; i < participants; ++i) {
+					_slots[i].next.store(i*chunks/participants, std::memory_order_relaxed);
+					_slots[i].end = (i + 1)*chunks/participants;
+				}
+				_pending.store(participants - 1, std::memory_order_relaxed);
+				_failed.store(false, std::memory_order_relaxed);
+				const size_t generation = ++_generation;
+				for (size_t i = 1; i < participants; ++i) { // only participants see the job
+					_slots[i].go.store(generation, std::memory_order_release);
+				}
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+				}
+				_wakeCV.notify_all();
+				_inJob() = true;
+				_work(0); // does not throw, exceptions of f are kept for the caller
+				_inJob() = false;
+				for (size_t i = 0; 0 != _pending.load(std::memory_order_acquire); ++i) { // gives the CPU away if workers are descheduled
+					(i < YIELD_SPIN) ? _pause() : std::this_thread::yield();
+				}
+				if (_failed.load(std::memory_order_relaxed)) { // all participants are done with f, the first exception goes to the caller
+					std::exception_ptr error;
+					std::swap(error, _error);
+					std::rethrow_exception(error);
+				}
+			}
+
+		private:
+			static constexpr size_t SPIN = 1 << 15; // checks of a new job before a worker sleeps
+			static constexpr size_t YIELD_SPIN = 1 << 10; // checks with pause before yielding the CPU between them
+
+			struct Job {
+				void (*run)(void *f, size_t begin, size_t end);
+				void *f;
+				size_t count;
+				size_t grain;
+				size_t participants;
+			};
+			// chunks [next, end) of a participant, others take them from next as well;
+			// go is the generation of the last job given to the worker
+			struct alignas(64) Slot {
+				std::atomic<size_t> next{0};
+				size_t end = 0;
+				std::atomic<size_t> go{0};
+			};
+
+			ThreadPool()
+				: ThreadPool(0) {
+			}
+			template <class F> static void _invoke(void *f, size_t begin, size_t end) {
+				(*static_cast<F *>(f))(begin, end);
+			}
+			static size_t &_limit() {
+				thread_local size_t limit = 0;
+				return limit;
+			}
+			static ThreadPool *&_current() {
+				thread_local ThreadPool *pool = nullptr;
+				return pool;
+			}
+			static size_t &_inlineRuns() {
+				thread_local size_t runs = 0;
+				return runs;
+			}
+			static bool &_isWorker() {
+				thread_local bool worker = false;
+				return worker;
+			}
+			// the thread is participant 0 of a job it submitted
+			static bool &_inJob() {
+				thread_local bool running = false;
+				return running;
+			}
+			static void _pause() {
+#if defined(__x86_64__) || defined(__i386__)
+				_mm_pause();
+#else
+				std::this_thread::yield();
+#endif
+			}
+			// runs own chunks of participant p, then steals the rest; after an exception
+			// participants take no more chunks and the first one is kept for the caller
+			void _work(size_t p) {
+				const Job &job = _job;
+				try {
+					for (size_t k = 0; k < job.participants; ++k) {
+						Slot &slot = _slots[(p + k) % job.participants];
+						for (size_t c = slot.next.fetch_add(1, std::memory_order_relaxed); (c < slot.end) && !_failed.load(std::memory_order_relaxed); c = slot.next.fetch_add(1, std::memory_order_relaxed)) {
+							const size_t begin = c*job.grain;
+							job.run(job.f, begin, std::min(job.count, begin + job.grain));
+						}
+					}
+				} catch (...) {
+					std::unique_lock<std::mutex> lock(_mutex);
+					if (!_failed.load(std::memory_order_relaxed)) {
+						_error = std::current_exception();
+						_failed.store(true, std::memory_order_relaxed);
+					}
+				}
+			}
+			void _loop(size_t index, int cpu) {
+				_isWorker() = true;
+#ifdef __linux__
+				if (cpu >= 0) {
+					cpu_set_t set;
+					CPU_ZERO(&set);
+					CPU_SET(cpu, &set);
+					pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+				}
+#endif
+				const Slot &slot = _slots[index];
+				size_t seen = 0;
+				while (true) {
+					size_t go = slot.go.load(std::memory_order_acquire);
+					for (size_t i = 0; (i < SPIN) && (seen == go) && !_stopping.load(std::memory_order_relaxed); ++i) {
+						(i < YIELD_SPIN) ? _pause() : std::this_thread::yield();
+						go = slot.go.load(std::memory_order_acquire);
+					}
+					if (seen == go) {
+						std::unique_lock<std::mutex> lock(_mutex);
+						_wakeCV.wait(lock, [this, &slot, seen]() {
+							return _stopping.load(std::memory_order_relaxed) || (slot.go.load(std::memory_order_acquire) != seen);
+						});
+						go = slot.go.load(std::memory_order_acquire);
+					}
+					if (_stopping.load(std::memory_order_relaxed)) {
+						break;
+					}
+					seen = go;
+					_work(index);
+					_pending.fetch_sub(1, std::memory_order_release);
+				}
+			}
+			void _stop() {
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_stopping = true;
+				}
+				_wakeCV.notify_all();
+				for (std::thread &t: _workers) {
+					t.join();
+				}
+				_workers.clear();
+			}
+
+			Affinity _affinity;
+			Job _job;
+			std::unique_ptr<Slot[]> _slots;
+			size_t _generation; // of the last job, guarded by _submit
+			std::atomic<size_t> _pending;
+			std::atomic<bool> _stopping;
+			std::atomic<bool> _failed; // f threw in the current job
+			std::exception_ptr _error; // the first exception of the job, under _mutex
+			std::mutex _submit; // one job at a time
+			std::mutex _mutex;
+			std::condition_variable _wakeCV;
+			std::vector<std::thread> _workers;
+	};
+}
+
+#endif
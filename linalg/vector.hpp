@@ -4,12 +4,14 @@
 #ifndef LINALG_VECTOR_HPP
 #define LINALG_VECTOR_HPP
 
+#include "linalg/allocator.hpp"
 #include <vector>
 
 namespace LinAlg {
-	template <class NUMBER> class Vector: public std::vector<NUMBER> {
+	template <class NUMBER> class Vector: public std::vector<NUMBER, Allocator<NUMBER>> {
 		public:
 			using Numer = NUMBER;
+			using std::vector<NUMBER, Allocator<NUMBER>>::vector;
 	};
 }
 #endif
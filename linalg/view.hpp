@@ -0,0 +1,207 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef LINALG_VIEW_HPP
+#define LINALG_VIEW_HPP
+
+#include "linalg/check.hpp"
+#include "linalg/expression.hpp"
+#include "linalg/half.hpp"
+#include "linalg/threadpool.hpp"
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+namespace LinAlg {
+	// Non-owning Rows() x Cols() window over elements: (r, c) is Data()[r*RowStride() + c*ColStride()].
+	// Transposition swaps the strides, a row, a column, a block or a range of rows of a batch
+	// keeps the strides and moves the origin, so all of them are O(1) and share the storage.
+	// Views are expression leaves: they may be operands of +, -, scaling and products
+	// (taken by GEMM with their strides, no copies), views must not outlive their storage.
+	template <class NUMBER, class COMPUTE = typename ComputeType<NUMBER>::Type> class ConstMatrixView: public Expression<ConstMatrixView<NUMBER, COMPUTE>> {
+		public:
+			using Number = NUMBER;
+			using Compute = COMPUTE;
+			ConstMatrixView()
+				: ConstMatrixView(nullptr, 0, 0) {
+			}
+			// row-major dense rows x cols
+			ConstMatrixView(const Number *data, size_t rows, size_t cols)
+				: ConstMatrixView(data, rows, cols, cols, 1) {
+			}
+			ConstMatrixView(const Number *data, size_t rows, size_t cols, size_t rs, size_t cs)
+				: _data(data)
+				, _rows(rows)
+				, _cols(cols)
+				, _rs(rs)
+				, _cs(cs) {
+			}
+			size_t Rows() const {
+				return _rows;
+			}
+			size_t Cols() const {
+				return _cols;
+			}
+			size_t RowStride() const {
+				return _rs;
+			}
+			size_t ColStride() const {
+				return _cs;
+			}
+			const Number *Data() const {
+				return _data;
+			}
+			// the view walks the storage column by column
+			bool IsTransposed() const {
+				return (1 != _cs) && (1 == _rs);
+			}
+			const Number &at(size_t r, size_t c) const {
+				_check(r, c);
+				return _data[r*_rs + c*_cs];
+			}
+
+			ConstMatrixView Transp() const {
+				return ConstMatrixView(_data, _cols, _rows, _cs, _rs);
+			}
+			ConstMatrixView Block(size_t r, size_t c, size_t rows, size_t cols) const {
+				_checkBlock(r, c, rows, cols);
+				return ConstMatrixView(_data + r*_rs + c*_cs, rows, cols, _rs, _cs);
+			}
+			// rows [begin, end), e.g. a part of a batch
+			ConstMatrixView RowRange(size_t begin, size_t end) const {
+				return Block(begin, 0, end - begin, _cols);
+			}
+			ConstMatrixView RowAt(size_t r) const {
+				return Block(r, 0, 1, _cols);
+			}
+			ConstMatrixView ColAt(size_t c) const {
+				return Block(0, c, _rows, 1);
+			}
+
+			// element access of expression nodes
+			Compute Get(size_t r, size_t c) const {
+				return Compute(_data[r*_rs + c*_cs]);
+			}
+			bool Linear() const {
+				return (1 == _cs) && ((_cols == _rs) || (1 == _rows));
+			}
+			Compute Get(size_t i) const {
+				return Compute(_data[i]);
+			}
+			Footprint Storage() const {
+				return Footprint::Of(_data, _rows, _cols, _rs, _cs);
+			}
+			bool Refers(const Footprint &f) const {
+				return Storage().Overlaps(f);
+			}
+			bool Aliases(const Footprint &f) const {
+				return Refers(f) && !Storage().Same(f);
+			}
+
+		protected:
+			void _check(size_t r, size_t c) const {
+				LINALG_CHECK(r < _rows, "Row Out Of Range");
+				LINALG_CHECK(c < _cols, "Col Out Of Range");
+				(void)r;
+				(void)c;
+			}
+			void _checkBlock(size_t r, size_t c, size_t rows, size_t cols) const {
+				if ((r > _rows) || (rows > _rows - r) || (c > _cols) || (cols > _cols - c)) {
+					throw std::runtime_error("Block Out Of Range");
+				}
+			}
+
+			const Number *_data;
+			size_t _rows;
+			size_t _cols;
+			size_t _rs;
+			size_t _cs;
+	};
+
+	// View of mutable elements: expressions are evaluated straight into it (products by GEMM
+	// when its rows are contiguous), sizes must match as a view is never resized.
+	// Assignment of a view copies elements, it does not rebind the view.
+	template <class NUMBER, class COMPUTE = typename ComputeType<NUMBER>::Type> class MatrixView: public ConstMatrixView<NUMBER, COMPUTE> {
+		public:
+			using Base = ConstMatrixView<NUMBER, COMPUTE>;
+			using Number = NUMBER;
+			using Compute = COMPUTE;
+			MatrixView()
+				: Base() {
+			}
+			MatrixView(Number *data, size_t rows, size_t cols)
+				: Base(data, rows, cols) {
+			}
+			MatrixView(Number *data, size_t rows, size_t cols, size_t rs, size_t cs)
+				: Base(data, rows, cols, rs, cs) {
+			}
+			MatrixView(const MatrixView &) = default;
+			// the pointer came from a mutable one
+			Number *Data() const {
+				return const_cast<Number *>(this->_data);
+			}
+			Number &at(size_t r, size_t c) const {
+				this->_check(r, c);
+				return Data()[r*this->_rs + c*this->_cs];
+			}
+
+			MatrixView Transp() const {
+				return MatrixView(Data(), this->_cols, this->_rows, this->_cs, this->_rs);
+			}
+			MatrixView Block(size_t r, size_t c, size_t rows, size_t cols) const {
+				this->_checkBlock(r, c, rows, cols);
+				return MatrixView(Data() + r*this->_rs + c*this->_cs, rows, cols, this->_rs, this->_cs);
+			}
+			MatrixView RowRange(size_t begin, size_t end) const {
+				return Block(begin, 0, end - begin, this->_cols);
+			}
+			MatrixView RowAt(size_t r) const {
+				return Block(r, 0, 1, this->_cols);
+			}
+			MatrixView ColAt(size_t c) const {
+				return Block(0, c, this->_rows, 1);
+			}
+
+			MatrixView &operator = (const MatrixView &other) {
+				return *this = static_cast<const Base &>(other);
+			}
+			template <class E> MatrixView &operator = (const Expression<E> &e) {
+				_assign<false>(e.Derived());
+				return *this;
+			}
+			template <class E> MatrixView &operator += (const Expression<E> &e) {
+				_assign<true>(e.Derived());
+				return *this;
+			}
+
+			template <class FUNCTION> void ApplyForEach(FUNCTION &&for_each, bool parallel=false) const {
+				Number *d = Data();
+				const size_t rows = this->_rows;
+				const size_t cols = this->_cols;
+				const size_t rs = this->_rs;
+				const size_t cs = this->_cs;
+				ThreadPool::Current().ParallelFor(rows, [&](size_t begin, size_t end) {
+					for (size_t r=begin; r<end; ++r) {
+						for (size_t c=0; c<cols; ++c) {
+							for_each(d[r*rs + c*cs]);
+						}
+					}
+				}, parallel);
+			}
+
+		private:
+			template <bool ACCUMULATE, class E> void _assign(const E &x) {
+				if ((this->_cols != x.Cols()) || (this->_rows != x.Rows())) {
+					throw std::runtime_error("Matrixes sizes mismatch");
+				}
+				if (x.Aliases(this->Storage())) {
+					const Matrix<typename E::Compute, typename E::Compute> tmp(x);
+					Evaluate<ACCUMULATE>(*this, tmp);
+				} else {
+					Evaluate<ACCUMULATE>(*this, x);
+				}
+			}
+	};
+}
+
+#endif
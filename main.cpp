@@ -4,220 +4,518 @@
 #include <iostream>
 #include <iomanip>
 #include "io/csvreader.hpp"
+#include "io/dataset.hpp"
+#include "io/prefetcher.hpp"
+#include "nn/dataparalleltrainer.hpp"
+#include "nn/pipelinetrainer.hpp"
 #include "nn/perceptron.hpp"
+#include "nn/quantized.hpp"
 
-using Perceptron = NN::TPerceptron<float>;
+using Perceptron = NN::TPerceptron<float, NN::Activation::Sigmoid>;
+using Trainer = NN::TDataParallelTrainer<Perceptron>;
+using PipelineTrainer = NN::TPipelineTrainer<Perceptron>;
+using QuantizedPerceptron = NN::TQuantizedPerceptron<Perceptron>;
+using HalfPerceptron = NN::TPerceptron<float, NN::Activation::Sigmoid, NN::Activation::Sigmoid, LinAlg::bf16>;
 
 namespace Demo {
-	void Train() {
-		auto sigmoid = [](Perceptron::Number &x) -> void {
-			x = 1./(1. + exp(-x));
+	const size_t INPUT_SIZE = 784; // input layer 28x28 or 784 pixels [0-255]
+	const size_t OUTPUT_SIZE = 10; // labels [0-9]
+	// Learning rate of one sample. Batch gradients are averaged, so the rate grows with the
+	// batch (linear scaling) to keep the step an epoch makes about the same for any batch size.
+	// Large steps diverge from random weights, so the rate rises from the one of a sample over
+	// the first WARMUP_SAMPLES.
+	const double LEARNING_RATE = 0.001;
+	const size_t WARMUP_SAMPLES = 5000;
+
+	// unit of work of the input pipeline: a few samples with their labels
+	struct Batch {
+		std::vector<Perceptron::Sample> samples;
+		std::vector<uint8_t> labels;
+		Batch(size_t size)
+			: samples(size, Perceptron::Sample(INPUT_SIZE, OUTPUT_SIZE))
+			, labels(size) {
+		}
+	};
+	using Pipeline = IO::Prefetcher<Batch>;
+
+	// opens binary cache <name>.bin of the dataset, on the first run converts it from <name>.csv
+	bool OpenDataset(IO::Dataset &ds, const std::string &name) {
+		bool res = false;
+		do {
+			if (ds.Open(name + ".bin")) {
+				res = true;
+				break;
+			}
+			std::cout << "converting " << name << ".csv to " << name << ".bin" << std::endl;
+			// each row in dataset must contains: the label [0-9] and INPUT_SIZE pixels, the first row contains header
+			if (!IO::DatasetWriter::ConvertCSV(name + ".csv", name + ".bin", INPUT_SIZE)) {
+				std::cerr << "Can't convert " << name << ".csv" << std::endl;
+				break;
+			}
+			if (!ds.Open(name + ".bin")) {
+				std::cerr << "Can't open " << name << ".bin" << std::endl;
+				break;
+			}
+			res = true;
+		} while (false);
+		return res;
+	}
+	// fills sample by dataset record, returns false for out-of-range label
+	bool LoadSample(const IO::Dataset::SampleView &view, Perceptron::Sample &sample) {
+		bool res = false;
+		do {
+			if (view.label > 9) {
+				break;
+			}
+			std::fill(sample.output.begin(), sample.output.end(), 0);
+			sample.output[view.label] = 1; // prepare output layer (right answer)
+			for (size_t i=0; i<sample.input.size(); ++i) {
+				sample.input[i] = view.features[i]/255.; // normalize pixel bright to (0-1) range
+			}
+			res = true;
+		} while (false);
+		return res;
+	}
+	// batches from the binary dataset, the source takes batches shard, shard+shards, ...
+	Pipeline::Source DatasetSource(const IO::Dataset &ds, size_t batchSize, size_t shard, size_t shards) {
+		size_t next = shard*batchSize;
+		return [&ds, batchSize, shards, next](Batch &batch) mutable -> bool {
+			size_t filled = 0;
+			if (batch.samples.size() != batchSize) { // restore buffers after the tail of dataset
+				batch.samples.resize(batchSize, Perceptron::Sample(INPUT_SIZE, OUTPUT_SIZE));
+				batch.labels.resize(batchSize);
+			}
+			for (size_t rowId = next; (rowId < next + batchSize) && (rowId < ds.Count()); ++rowId) {
+				IO::Dataset::SampleView view = ds.Sample(rowId);
+				if (!LoadSample(view, batch.samples[filled])) {
+					std::cerr << "row #" << rowId + 1 << " contains out-of-range label... skipping" << std::endl;
+					continue;
+				}
+				batch.labels[filled++] = view.label;
+			}
+			next += batchSize*shards;
+			batch.samples.resize(filled); // only the tail of dataset shrinks it
+			batch.labels.resize(filled);
+			return filled > 0;
 		};
-		auto dsigmoid = [](const Perceptron::Number &x) -> Perceptron::Number {
-			return x*(1.-x);
+	}
+	// batches parsed straight from CSV when its binary cache is not available
+	Pipeline::Source CSVSource(IO::CSVReader &csv, size_t batchSize) {
+		return [&csv, batchSize](Batch &batch) -> bool {
+			size_t filled = 0;
+			int row[1 + INPUT_SIZE];
+			size_t count = 0;
+			if (batch.samples.size() != batchSize) { // restore buffers after the tail of dataset
+				batch.samples.resize(batchSize, Perceptron::Sample(INPUT_SIZE, OUTPUT_SIZE));
+				batch.labels.resize(batchSize);
+			}
+			IO::CSVReader::Status status;
+			while ((filled < batchSize) && (IO::CSVReader::Status::End != (status = csv.ParseRow(row, 1 + INPUT_SIZE, count, ',')))) {
+				bool valid = (IO::CSVReader::Status::Ok == status) && (1 + INPUT_SIZE == count) && (row[0] >= 0) && (row[0] < (int)OUTPUT_SIZE);
+				for (size_t i = 1; valid && (i < count); ++i) {
+					valid = (row[i] >= 0) && (row[i] <= 255);
+				}
+				if (!valid) {
+					std::cerr << "row #" << csv.LastError().row << " is invalid... skipping" << std::endl;
+					continue;
+				}
+				Perceptron::Sample &sample = batch.samples[filled];
+				std::fill(sample.output.begin(), sample.output.end(), 0);
+				sample.output[row[0]] = 1;
+				for (size_t i = 0; i < INPUT_SIZE; ++i) {
+					sample.input[i] = row[i + 1]/255.;
+				}
+				batch.labels[filled++] = row[0];
+			}
+			batch.samples.resize(filled);
+			batch.labels.resize(filled);
+			return filled > 0;
 		};
-		Perceptron net(0.001, sigmoid, dsigmoid);
-
+	}
+	// starts pipeline on binary cache of the dataset, or on CSV itself if the cache can't be made
+	bool StartPipeline(Pipeline &pipeline, IO::Dataset &ds, IO::CSVReader &csv, const std::string &name, size_t batchSize) {
+		bool res = false;
 		do {
-			IO::CSVReader csv;
-			std::vector<std::string> row;
-			size_t ds_rowsize = 1+784; // each row in dataset must contains: the label [0-9] and input layer 28x28 or 784 pixels [0-255]
-			if (!csv.Open("mnist_train.csv")) { // downloaded from https://pjreddie.com/media/files/mnist_train.csv
-				std::cerr << "Can't open mnist_train.csv" << std::endl;
+			if (OpenDataset(ds, name)) {
+				if (INPUT_SIZE != ds.Features()) { // incorrect dataset?
+					std::cerr << "error dataset row size" << std::endl;
+					break;
+				}
+				const size_t producers = std::min(2u, std::max(1u, std::thread::hardware_concurrency()/2));
+				std::vector<Pipeline::Source> sources;
+				for (size_t i = 0; i < producers; ++i) {
+					sources.push_back(DatasetSource(ds, batchSize, i, producers));
+				}
+				pipeline.Start(sources);
+				res = true;
 				break;
 			}
-			if (!csv.ReadRow(row, ',')) { // The first row contains header, so just skip it
-				std::cerr << "error reading mnist_train.csv" << std::endl;
+			std::vector<std::string_view> header;
+			if (!csv.OpenMapped(name + ".csv")) {
+				std::cerr << "Can't open " << name << ".csv" << std::endl;
 				break;
 			}
-			if (ds_rowsize != row.size()) { // if header row has incorrect size (incorrect dataset?)
-				std::cerr << "error dataset header row size" << std::endl;
+			if (!csv.ReadRow(header, ',')) { // The first row contains header, so just skip it
+				std::cerr << "error reading " << name << ".csv" << std::endl;
 				break;
 			}
+			std::cout << "reading " << name << ".csv directly" << std::endl;
+			pipeline.Start(CSVSource(csv, batchSize));
+			res = true;
+		} while (false);
+		return res;
+	}
+
+	void Train(size_t batchSize, size_t threads) {
+		Perceptron net(LEARNING_RATE*batchSize);
 
-			net.BuildTopology({784, 512, 256, 128, 64, 16, 10}); // create internal network infrastructure (layers, weights and so on...)
+		do {
+			IO::Dataset ds;
+			IO::CSVReader csv;
+			Pipeline pipeline(8, Batch(batchSize)); // batches are decoded in background while the net trains
+			if (!StartPipeline(pipeline, ds, csv, "mnist_train", batchSize)) { // downloaded from https://pjreddie.com/media/files/mnist_train.csv
+				break;
+			}
+
+			net.BuildTopology({INPUT_SIZE, 512, 256, 128, 64, 16, OUTPUT_SIZE}, batchSize); // create internal network infrastructure (layers, weights and so on...)
 			net.Init(); // fill the net by random values
+			Trainer trainer(net, threads, batchSize); // every batch is split between threads
 
-			Perceptron::Sample sample(net.InSize(), net.OutSize()); // create sample for the network;
-			std::fill(sample.output.begin(), sample.output.end(), 0); // fill output by 0
-			uint8_t lastLabel = 0; // remember last label to fast clearing output
 			struct {
 				size_t right;
 				double errorSum;
 			} stat = {0, 0.}; // will calculate statistic
-			size_t rowId = 0;
+			size_t processed = 0;
+			size_t allocations = LinAlg::Allocations(); // linalg heap allocations, must not grow in steady state
 			std::chrono::high_resolution_clock local_clock;
 			auto start = local_clock.now();
 			auto stop = start;
-			while (csv.ReadRow(row, ',')) { // read dataset row by row...
-				rowId++;
-				if (ds_rowsize != row.size()) { // row has incorrect size, so skip it
-					std::cerr << "row #" << rowId << " has incorrect size... skipping" << std::endl;
-					continue;
-				}
-				try { // try to load sample
-					sample.output[lastLabel]=0; // clear last output
-					int label = std::stoi(row[0]);
-					if ((label < 0) || (label > 9)) {
-						std::cerr << "row #" << rowId << " contains out-of-range label... skipping" << std::endl;
-						continue;
-					}
-					sample.output[label] = 1; // prepare output layer (right answer)
-					lastLabel = label; // remember last label for next row
-					for (size_t i=1; i<row.size(); ++i) {
-						int pixel = std::stoi(row[i]);
-						if ((pixel < 0) || (pixel > 255)) {
-							std::cerr << "row #" << rowId << " contains out-of-range pixel... skipping" << std::endl;
-							continue;
+			while (Batch *batch = pipeline.Acquire()) { // take prepared batches one by one...
+				net.SetLearningRate(LEARNING_RATE*(1. + (batchSize - 1.)*std::min<size_t>(processed, WARMUP_SAMPLES)/WARMUP_SAMPLES));
+				const Perceptron::Matrix &answers = trainer.TrainBatch(batch->samples); // feed the net and train it
+				for (size_t s = 0; s < batch->samples.size(); ++s) {
+					uint8_t lastLabel = batch->labels[s];
+					int maxLabel = 0;
+					double maxLabelWeight = -1;
+					if (true) { // check result
+						for (size_t k = 0; k < answers.Cols(); k++) {
+							if (answers.at(s, k) > maxLabelWeight) {
+								maxLabelWeight = answers.at(s, k);
+								maxLabel = k;
+							}
 						}
-						sample.input[i-1] = pixel/255.; // normalize pixel bright to (0-1) range
 					}
-				} catch (const std::invalid_argument &) {
-					std::cerr << "row #" << rowId << " contains non-number... skipping" << std::endl;
-					continue;
-				} catch (const std::out_of_range &) {
-					std::cerr << "row #" << rowId << " contains out-of-range values... skipping" << std::endl;
-					continue;
-				}
-				// at this moment we have loaded sample (input layer and ideal output value)
-
-				Perceptron::Vector answer = net.feedForward(sample.input); // feed the net
-				int maxLabel = 0;
-				double maxLabelWeight = -1;
-				if (true) { // check result
-					for (size_t k = 0; k < answer.size(); k++) {
-						if (answer[k] > maxLabelWeight) {
-							maxLabelWeight = answer[k];
-							maxLabel = k;
+					if (true) { // update statistics
+						if (lastLabel == maxLabel) { // net guess the lable right
+							stat.right++;
+						}
+						for (size_t k = 0; k < answers.Cols(); k++) {
+							stat.errorSum += ((lastLabel == k)?1:0 - answers.at(s, k)) * ((lastLabel == k)?1:0 - answers.at(s, k));
 						}
 					}
-				}
-				if (true) { // update statistics
-					if (lastLabel == maxLabel) { // net guess the lable right
-						stat.right++;
-					}
-					for (size_t k = 0; k < answer.size(); k++) {
-						stat.errorSum += ((lastLabel == k)?1:0 - answer[k]) * ((lastLabel == k)?1:0 - answer[k]);
+					processed++;
+					if (0 == processed % 100) { // each 100 rows out statistic and reset it
+						stop = local_clock.now();
+						std::cout << std::setw(6) << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << " ms " << std::setw(6) << processed << " processed, guessed: " << std::setw(3) << (int)stat.right << "%, error: " << (int)stat.errorSum << ", allocs: " << LinAlg::Allocations() - allocations << std::endl;
+						stat = {0, 0.};
+						allocations = LinAlg::Allocations();
+						start = stop;
 					}
 				}
-				net.backpropagation(sample.output); // training
-
-				if ((rowId > 0) && (0 == rowId % 100)) { // each 100 rows out statistic and reset it
-					stop = local_clock.now();
-					std::cout << std::setw(6) << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << " ms " << std::setw(6) << rowId << " processed, guessed: " << std::setw(3) << (int)stat.right << "%, error: " << (int)stat.errorSum << std::endl;
-					stat = {0, 0.};
-					start = stop;
-				}
+				pipeline.Release(batch); // give the buffer back to the pipeline
 			}
 			net.SaveToFile("mnist.nn");
 		} while (false);
 	}
-	void Test() {
-		auto sigmoid = [](Perceptron::Number &x) -> void {
-			x = 1./(1. + exp(-x));
-		};
-		auto dsigmoid = [](const Perceptron::Number &x) -> Perceptron::Number {
-			return x*(1.-x);
-		};
-		Perceptron net(0.001, sigmoid, dsigmoid);
-
+	// training throughput for 1, 2, 4, ... threads on the first batches of the training dataset,
+	// split of batches between threads and then of layers between pipeline stages
+	void Scaling(size_t batchSize) {
 		do {
-			IO::CSVReader csv;
-			std::vector<std::string> row;
-			size_t ds_rowsize = 1+784; // each row in dataset must contains: the label [0-9] and input layer 28x28 or 784 pixels [0-255]
-			if (!csv.Open("mnist_test.csv")) { // downloaded from https://pjreddie.com/media/files/mnist_test.csv
-				std::cerr << "Can't open mnist_test.csv" << std::endl;
+			const size_t BATCHES = 64;
+			IO::Dataset ds;
+			if (!OpenDataset(ds, "mnist_train")) {
 				break;
 			}
-			if (!csv.ReadRow(row, ',')) { // The first row contains header, so just skip it
-				std::cerr << "error reading mnist_test.csv" << std::endl;
+			if (INPUT_SIZE != ds.Features()) {
+				std::cerr << "error dataset row size" << std::endl;
 				break;
 			}
-			if (ds_rowsize != row.size()) { // if header row has incorrect size (incorrect dataset?)
-				std::cerr << "error dataset header row size" << std::endl;
+			std::vector<Batch> batches;
+			Pipeline::Source source = DatasetSource(ds, batchSize, 0, 1);
+			for (Batch batch(batchSize); (batches.size() < BATCHES) && source(batch); ) {
+				batches.push_back(batch);
+			}
+			const size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+			for (size_t threads = 1; ; threads = std::min(threads*2, maxThreads)) {
+				Perceptron net(LEARNING_RATE*batchSize);
+				net.BuildTopology({INPUT_SIZE, 512, 256, 128, 64, 16, OUTPUT_SIZE}, batchSize);
+				net.Init();
+				Trainer trainer(net, threads, batchSize);
+				trainer.TrainBatch(batches.front().samples); // warm up
+				size_t processed = 0;
+				std::chrono::high_resolution_clock local_clock;
+				auto start = local_clock.now();
+				for (const Batch &batch: batches) {
+					trainer.TrainBatch(batch.samples);
+					processed += batch.samples.size();
+				}
+				std::chrono::duration<double> elapsed = local_clock.now() - start;
+				std::cout << std::setw(3) << threads << " threads: " << std::setw(8) << (int)(processed/elapsed.count()) << " samples/s" << std::endl;
+				if (threads == maxThreads) {
+					break;
+				}
+			}
+			const size_t microBatch = std::max<size_t>(1, batchSize/8);
+			for (size_t stages = 2; stages <= std::max<size_t>(2, maxThreads); stages *= 2) {
+				Perceptron net(LEARNING_RATE*batchSize);
+				net.BuildTopology({INPUT_SIZE, 512, 256, 128, 64, 16, OUTPUT_SIZE}, batchSize);
+				net.Init();
+				PipelineTrainer trainer(net, stages, microBatch, batchSize);
+				trainer.TrainBatch(batches.front().samples); // warm up
+				size_t processed = 0;
+				std::chrono::high_resolution_clock local_clock;
+				auto start = local_clock.now();
+				for (const Batch &batch: batches) {
+					trainer.TrainBatch(batch.samples);
+					processed += batch.samples.size();
+				}
+				std::chrono::duration<double> elapsed = local_clock.now() - start;
+				std::cout << std::setw(3) << trainer.Stages() << " stages: " << std::setw(8) << (int)(processed/elapsed.count()) << " samples/s (pipeline, micro-batches of " << microBatch << ")" << std::endl;
+				if (trainer.Stages() < stages) { // no more layers to split
+					break;
+				}
+			}
+		} while (false);
+	}
+	void Test() {
+		Perceptron net(0.001);
+
+		do {
+			const size_t batchSize = 100;
+			IO::Dataset ds;
+			IO::CSVReader csv;
+			Pipeline pipeline(4, Batch(batchSize));
+			if (!StartPipeline(pipeline, ds, csv, "mnist_test", batchSize)) { // downloaded from https://pjreddie.com/media/files/mnist_test.csv
 				break;
 			}
 			net.LoadFromFile("mnist.nn"); // load trained network from file
 
-			Perceptron::Sample sample(net.InSize(), net.OutSize()); // create sample for the network;
-			uint8_t lastLabel = 0; // remember last label to fast clearing output
 			struct {
 				size_t right;
 				double errorSum;
 			} local_stat = {0, 0.}; // will calculate local (per 100 samples)
 			auto global_stat = local_stat; //  and global (whole dataset) statistic
 			size_t rowId = 0;
+			size_t allocations = LinAlg::Allocations(); // linalg heap allocations, must not grow in steady state
 			std::chrono::high_resolution_clock local_clock;
 			auto start = local_clock.now();
 			auto stop = start;
-			while (csv.ReadRow(row, ',')) { // read dataset row by row...
-				rowId++;
-				if (ds_rowsize != row.size()) { // row has incorrect size, so skip it
-					std::cerr << "row #" << rowId << " has incorrect size... skipping" << std::endl;
-					continue;
-				}
-				try { // try to load sample
-					sample.output[lastLabel]=0; // clear last output
-					int label = std::stoi(row[0]);
-					if ((label < 0) || (label > 9)) {
-						std::cerr << "row #" << rowId << " contains out-of-range label... skipping" << std::endl;
-						continue;
+			while (Batch *batch = pipeline.Acquire()) { // take prepared samples by batches...
+				for (size_t s = 0; s < batch->samples.size(); ++s) {
+					uint8_t lastLabel = batch->labels[s];
+					rowId++;
+					const Perceptron::Vector &answer = net.feedForward(batch->samples[s].input); // feed the net
+					int maxLabel = 0;
+					double maxLabelWeight = -1;
+					if (true) { // check result
+						for (size_t k = 0; k < answer.size(); k++) {
+							if (answer[k] > maxLabelWeight) {
+								maxLabelWeight = answer[k];
+								maxLabel = k;
+							}
+						}
 					}
-					sample.output[label] = 1; // prepare output layer (right answer)
-					lastLabel = label; // remember last label for next row
-					for (size_t i=1; i<row.size(); ++i) {
-						int pixel = std::stoi(row[i]);
-						if ((pixel < 0) || (pixel > 255)) {
-							std::cerr << "row #" << rowId << " contains out-of-range pixel... skipping" << std::endl;
-							continue;
+					if (true) { // update statistics
+						if (lastLabel == maxLabel) { // net guess the lable right
+							local_stat.right++;
+							global_stat.right++;
+						}
+						for (size_t k = 0; k < answer.size(); k++) {
+							local_stat.errorSum += ((lastLabel == k)?1:0 - answer[k]) * ((lastLabel == k)?1:0 - answer[k]);
+							global_stat.errorSum += ((lastLabel == k)?1:0 - answer[k]) * ((lastLabel == k)?1:0 - answer[k]);
 						}
-						sample.input[i-1] = pixel/255.; // normalize pixel bright to (0-1) range
 					}
-				} catch (const std::invalid_argument &) {
-					std::cerr << "row #" << rowId << " contains non-number... skipping" << std::endl;
-					continue;
-				} catch (const std::out_of_range &) {
-					std::cerr << "row #" << rowId << " contains out-of-range values... skipping" << std::endl;
-					continue;
+					if ((rowId > 0) && (0 == rowId % 100)) { // each 100 rows out statistic and reset it
+						stop = local_clock.now();
+						std::cout << std::setw(8) << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << " ms " << std::setw(5) << rowId << " processed, guessed: " << std::setw(3) << (int)local_stat.right << "%, error: " << (int)local_stat.errorSum << ", allocs: " << LinAlg::Allocations() - allocations << std::endl;
+						local_stat = {0, 0.};
+						allocations = LinAlg::Allocations();
+						start = stop;
+					}
 				}
-				// at this moment we have loaded sample (input layer and ideal output value)
+				pipeline.Release(batch);
+			}
+			std::cout << "Total guessed: " << global_stat.right*100./rowId << "%" << std::endl;
+		} while (false);
+	}
+	// loads valid samples of the dataset, at most limit of them
+	bool LoadSamples(const std::string &name, size_t limit, std::vector<Perceptron::Sample> &samples, std::vector<uint8_t> &labels) {
+		bool res = false;
+		do {
+			IO::Dataset ds;
+			if (!OpenDataset(ds, name) || (INPUT_SIZE != ds.Features())) {
+				break;
+			}
+			Perceptron::Sample sample(INPUT_SIZE, OUTPUT_SIZE);
+			for (size_t rowId = 0; (rowId < ds.Count()) && (samples.size() < limit); ++rowId) {
+				IO::Dataset::SampleView view = ds.Sample(rowId);
+				if (LoadSample(view, sample)) {
+					samples.push_back(sample);
+					labels.push_back(view.label);
+				}
+			}
+			res = !samples.empty();
+		} while (false);
+		return res;
+	}
+	// int8 copy and bf16 weights of the trained network: compared with the float one on the test dataset
+	void Quantization() {
+		Perceptron net(0.001);
+		HalfPerceptron hnet(0.001);
 
-				Perceptron::Vector answer = net.feedForward(sample.input); // feed the net
-				int maxLabel = 0;
-				double maxLabelWeight = -1;
-				if (true) { // check result
-					for (size_t k = 0; k < answer.size(); k++) {
-						if (answer[k] > maxLabelWeight) {
-							maxLabelWeight = answer[k];
-							maxLabel = k;
+		do {
+			std::vector<Perceptron::Sample> calibration;
+			std::vector<Perceptron::Sample> samples;
+			std::vector<uint8_t> labels;
+			if (!net.LoadFromFile("mnist.nn") || !hnet.LoadFromFile("mnist.nn") || !LoadSamples("mnist_train", 1000, calibration, labels)) {
+				std::cerr << "error loading mnist.nn or mnist_train" << std::endl;
+				break;
+			}
+			labels.clear();
+			if (!LoadSamples("mnist_test", std::numeric_limits<size_t>::max(), samples, labels)) {
+				break;
+			}
+			QuantizedPerceptron qnet;
+			if (!qnet.Quantize(net, calibration)) {
+				break;
+			}
+			Perceptron::Workspace ws;
+			HalfPerceptron::Workspace hws;
+			QuantizedPerceptron::Workspace qws;
+			struct {
+				size_t right;
+				double seconds;
+			} fp = {0, 0.}, q8 = fp, h16 = fp;
+			size_t agreed = 0;
+			size_t hagreed = 0;
+			double maxDiff = 0;
+			double hmaxDiff = 0;
+			std::chrono::high_resolution_clock local_clock;
+			for (size_t i = 0; i < samples.size(); ++i) {
+				auto start = local_clock.now();
+				const Perceptron::Vector &answer = net.Predict(samples[i].input, ws);
+				auto middle = local_clock.now();
+				const Perceptron::Vector &qanswer = qnet.Predict(samples[i].input, qws);
+				auto stop = local_clock.now();
+				const HalfPerceptron::Vector &hanswer = hnet.Predict(samples[i].input, hws);
+				auto hstop = local_clock.now();
+				fp.seconds += std::chrono::duration<double>(middle - start).count();
+				q8.seconds += std::chrono::duration<double>(stop - middle).count();
+				h16.seconds += std::chrono::duration<double>(hstop - stop).count();
+				const size_t label = std::max_element(answer.begin(), answer.end()) - answer.begin();
+				const size_t qlabel = std::max_element(qanswer.begin(), qanswer.end()) - qanswer.begin();
+				fp.right += (label == labels[i]) ? 1 : 0;
+				q8.right += (qlabel == labels[i]) ? 1 : 0;
+				agreed += (label == qlabel) ? 1 : 0;
+				const size_t hlabel = std::max_element(hanswer.begin(), hanswer.end()) - hanswer.begin();
+				h16.right += (hlabel == labels[i]) ? 1 : 0;
+				hagreed += (label == hlabel) ? 1 : 0;
+				for (size_t k = 0; k < answer.size(); ++k) {
+					maxDiff = std::max(maxDiff, (double)std::fabs(answer[k] - qanswer[k]));
+					hmaxDiff = std::max(hmaxDiff, (double)std::fabs(answer[k] - hanswer[k]));
+				}
+			}
+			std::cout << "float: guessed " << fp.right*100./samples.size() << "%, " << (int)(samples.size()/fp.seconds) << " predictions/s, weights " << net.WeightBytes()/1024 << " KiB" << std::endl;
+			std::cout << " int8: guessed " << q8.right*100./samples.size() << "%, " << (int)(samples.size()/q8.seconds) << " predictions/s, weights " << qnet.WeightBytes()/1024 << " KiB" << std::endl;
+			std::cout << " bf16: guessed " << h16.right*100./samples.size() << "%, " << (int)(samples.size()/h16.seconds) << " predictions/s, weights " << hnet.WeightBytes()/1024 << " KiB" << std::endl;
+			std::cout << "int8 agrees with float on " << agreed*100./samples.size() << "% of samples, max output difference " << maxDiff << std::endl;
+			std::cout << "bf16 agrees with float on " << hagreed*100./samples.size() << "% of samples, max output difference " << hmaxDiff << std::endl;
+		} while (false);
+	}
+	// inference throughput of one shared network queried by 1, 8 and 32 threads at once
+	void Serving() {
+		Perceptron net(0.001);
+
+		do {
+			std::vector<Perceptron::Sample> samples;
+			std::vector<uint8_t> labels;
+			auto start = std::chrono::high_resolution_clock::now();
+			if (!net.MapFromFile("mnist.nn")) { // weights are used right from the file
+				std::cerr << "error loading mnist.nn" << std::endl;
+				break;
+			}
+			std::cout << "mnist.nn mapped in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+			if (!LoadSamples("mnist_test", std::numeric_limits<size_t>::max(), samples, labels)) {
+				std::cerr << "error loading mnist_test" << std::endl;
+				break;
+			}
+			const size_t PREDICTIONS = 20000;
+			for (size_t callers: {1, 8, 32}) {
+				std::vector<size_t> right(callers, 0);
+				std::vector<std::thread> threads;
+				std::chrono::high_resolution_clock local_clock;
+				auto start = local_clock.now();
+				for (size_t t = 0; t < callers; ++t) {
+					threads.emplace_back([&, t]() {
+						Perceptron::Workspace ws; // scratch state of this caller only
+						for (size_t i = t; i < PREDICTIONS; i += callers) {
+							const Perceptron::Vector &answer = net.Predict(samples[i % samples.size()].input, ws);
+							if (std::max_element(answer.begin(), answer.end()) - answer.begin() == labels[i % samples.size()]) {
+								right[t]++;
+							}
 						}
-					}
+					});
 				}
-				if (true) { // update statistics
-					if (lastLabel == maxLabel) { // net guess the lable right
-						local_stat.right++;
-						global_stat.right++;
-					}
-					for (size_t k = 0; k < answer.size(); k++) {
-						local_stat.errorSum += ((lastLabel == k)?1:0 - answer[k]) * ((lastLabel == k)?1:0 - answer[k]);
-						global_stat.errorSum += ((lastLabel == k)?1:0 - answer[k]) * ((lastLabel == k)?1:0 - answer[k]);
-					}
+				for (std::thread &t: threads) {
+					t.join();
 				}
-				if ((rowId > 0) && (0 == rowId % 100)) { // each 100 rows out statistic and reset it
-					stop = local_clock.now();
-					std::cout << std::setw(8) << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << " ms " << std::setw(5) << rowId << " processed, guessed: " << std::setw(3) << (int)local_stat.right << "%, error: " << (int)local_stat.errorSum << std::endl;
-					local_stat = {0, 0.};
-					start = stop;
+				std::chrono::duration<double> elapsed = local_clock.now() - start;
+				size_t guessed = 0;
+				for (size_t r: right) {
+					guessed += r;
 				}
+				std::cout << std::setw(3) << callers << " callers: " << std::setw(8) << (int)(PREDICTIONS/elapsed.count()) << " predictions/s, guessed: " << guessed*100./PREDICTIONS << "%" << std::endl;
 			}
-			std::cout << "Total guessed: " << global_stat.right*100./rowId << "%" << std::endl;
 		} while (false);
 	}
 }
 
-int main() {
-	Demo::Train();
+int main(int argc, char *argv[]) {
+	if ((argc > 1) && (std::string("--scaling") == argv[1])) { // --scaling [batch size]
+		Demo::Scaling((argc > 2) ? std::max(1, atoi(argv[2])) : 64);
+		return 0;
+	}
+	size_t batchSize = 16; // mini-batch size, may be passed as the first argument
+	size_t threads = 1; // training threads, may be passed as the second argument
+	if (argc > 1) {
+		batchSize = std::max(1, atoi(argv[1]));
+	}
+	if (argc > 2) {
+		threads = std::max(1, atoi(argv[2]));
+	}
+	std::cout << "kernels: " << LinAlg::IsaName(LinAlg::ActiveIsa()) << ", " << LinAlg::ThreadPool::Instance().Threads() << " threads" << std::endl; // the best the CPU supports unless LINALG_ISA says otherwise
+	LinAlg::Autotuner &tuner = LinAlg::Autotuner::Instance();
+	if (tuner.Load("gemm.tune")) { // kernel choices measured by previous runs
+		std::cout << "loaded " << tuner.Size() << " tuned GEMM shapes" << std::endl;
+	}
+#ifdef PROFILE_ENABLED
+	// per-layer and per-phase counters of training, the share of peak is printed when
+	// PERCEPTRON_PEAK_GFLOPS tells the machine's peak
+	const char *peak = std::getenv("PERCEPTRON_PEAK_GFLOPS");
+	Profile::Profiler &profiler = Profile::Profiler::Instance();
+	profiler.StartReporting(std::chrono::seconds(10), std::cout, peak ? std::atof(peak) : 0);
+	Demo::Train(batchSize, threads);
+	profiler.StopReporting();
+	profiler.Report(std::cout, peak ? std::atof(peak) : 0);
+	profiler.Reset();
+#else
+	Demo::Train(batchSize, threads);
+#endif
 	Demo::Test();
+	Demo::Serving();
+	Demo::Quantization();
+	tuner.Wait(); // let the shapes met on this run be measured
+	tuner.Save("gemm.tune");
 
 	std::cout << "Done." << std::endl;
 	return 0;
@@ -2,10 +2,55 @@
 	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
 */
 #include "distribution.hpp"
+#include "linalg/threadpool.hpp"
+#include <chrono>
+#include <random>
 
 namespace MathStat {
-	Distribution::Distribution() {
+	namespace {
+		// element i is At(first + i) whichever thread computes it
+		template <class T> void FillImpl(const Distribution &d, T *dst, size_t count, uint64_t first, bool parallel) {
+			const size_t GRAIN = 1 << 14;
+			LinAlg::ThreadPool::Current().ParallelFor(count, [&d, dst, first](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					dst[i] = T(d.At(first + i));
+				}
+			}, parallel, GRAIN);
+		}
+	}
+
+	Distribution::Distribution(uint64_t seed)
+		: _seed(seed)
+		, _next(0) {
 	}
 	Distribution::~Distribution() {
 	}
+	double Distribution::getDouble() {
+		return At(_next++);
+	}
+	void Distribution::Fill(float *dst, size_t count, uint64_t first, bool parallel) const {
+		FillImpl(*this, dst, count, first, parallel);
+	}
+	void Distribution::Fill(double *dst, size_t count, uint64_t first, bool parallel) const {
+		FillImpl(*this, dst, count, first, parallel);
+	}
+	void Distribution::Seed(uint64_t seed) {
+		_seed = seed;
+		_next = 0;
+	}
+	uint64_t Distribution::Seed() const {
+		return _seed;
+	}
+	uint64_t Distribution::RandomSeed() {
+		std::random_device rd;
+		const uint64_t entropy = (uint64_t(rd()) << 32) | rd();
+		return entropy ^ std::chrono::high_resolution_clock::now().time_since_epoch().count();
+	}
+	Philox::Block Distribution::Bits(uint64_t index) const {
+		return Philox::Generate(index, 0, _seed);
+	}
+	double Distribution::Unit(uint32_t hi, uint32_t lo) {
+		const uint64_t bits = ((uint64_t(hi) << 32) | lo) >> 11;
+		return bits*(1./9007199254740992.); // 2^-53
+	}
 }
@@ -4,12 +4,37 @@
 #ifndef MATHSTAT_DISTRIBUTION_HPP
 #define MATHSTAT_DISTRIBUTION_HPP
 
+#include "mathstat/philox.hpp"
+#include <cstddef>
+#include <cstdint>
+
 namespace MathStat {
+	/*
+		A distribution is an indexed sequence of values: At(index) depends only on the seed
+		and the index, so bulk Fill() gives the same numbers however it is split between
+		threads. getDouble() walks the sequence and is not meant for concurrent use.
+	*/
 	class Distribution {
 		public:
-			Distribution();
-			virtual double getDouble()=0;
+			Distribution(uint64_t seed=0);
+			virtual double At(uint64_t index) const=0;
+			virtual double getDouble();
 			virtual ~Distribution();
+
+			// dst[i] = At(first + i)
+			void Fill(float *dst, size_t count, uint64_t first=0, bool parallel=false) const;
+			void Fill(double *dst, size_t count, uint64_t first=0, bool parallel=false) const;
+			void Seed(uint64_t seed);
+			uint64_t Seed() const;
+			// seed from the system entropy source and time
+			static uint64_t RandomSeed();
+		protected:
+			Philox::Block Bits(uint64_t index) const;
+			// uniform value of [0, 1) with 53 random bits
+			static double Unit(uint32_t hi, uint32_t lo);
+		private:
+			uint64_t _seed;
+			uint64_t _next;
 	};
 }
 
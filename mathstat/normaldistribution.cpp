@@ -0,0 +1,19 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#include "mathstat/normaldistribution.hpp"
+#include <cmath>
+
+namespace MathStat {
+	NormalDistribution::NormalDistribution(double mean, double stddev, bool randomize)
+		: Distribution(randomize ? RandomSeed() : 0)
+		, _mean(mean)
+		, _stddev(stddev) {
+	}
+	double NormalDistribution::At(uint64_t index) const {
+		const Philox::Block bits = Bits(index);
+		const double u1 = 1. - Unit(bits[0], bits[1]); // (0, 1], so the logarithm is finite
+		const double u2 = Unit(bits[2], bits[3]);
+		return _mean + _stddev*std::sqrt(-2.*std::log(u1))*std::cos(2.*M_PI*u2);
+	}
+}
@@ -0,0 +1,22 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef MATHSTAT_NORMALDISTRIBUTION_HPP
+#define MATHSTAT_NORMALDISTRIBUTION_HPP
+
+#include "mathstat/distribution.hpp"
+
+namespace MathStat {
+	// Gaussian values by Box-Muller transform of two uniforms of the same counter block
+	class NormalDistribution: public Distribution {
+		public:
+			// not randomized distribution starts from seed 0, see Seed()
+			NormalDistribution(double mean=0., double stddev=1., bool randomize=true);
+			double At(uint64_t index) const override;
+		private:
+			double _mean;
+			double _stddev;
+	};
+}
+
+#endif
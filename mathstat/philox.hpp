@@ -0,0 +1,41 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef MATHSTAT_PHILOX_HPP
+#define MATHSTAT_PHILOX_HPP
+
+#include <array>
+#include <cstdint>
+
+namespace MathStat {
+	/*
+		Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers:
+		as easy as 1, 2, 3"). The output is a pure function of a 128-bit counter and a
+		64-bit key, so any element of a stream can be computed directly by any thread.
+	*/
+	struct Philox {
+		using Block = std::array<uint32_t, 4>;
+
+		static Block Generate(uint64_t counter, uint64_t stream, uint64_t key) {
+			uint32_t c0 = uint32_t(counter);
+			uint32_t c1 = uint32_t(counter >> 32);
+			uint32_t c2 = uint32_t(stream);
+			uint32_t c3 = uint32_t(stream >> 32);
+			uint32_t k0 = uint32_t(key);
+			uint32_t k1 = uint32_t(key >> 32);
+			for (int round = 0; round < 10; ++round) {
+				const uint64_t p0 = uint64_t(0xD2511F53u)*c0;
+				const uint64_t p1 = uint64_t(0xCD9E8D57u)*c2;
+				c0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+				c1 = uint32_t(p1);
+				c2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+				c3 = uint32_t(p0);
+				k0 += 0x9E3779B9u;
+				k1 += 0xBB67AE85u;
+			}
+			return {c0, c1, c2, c3};
+		}
+	};
+}
+
+#endif
@@ -2,15 +2,15 @@
 	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
 */
 #include "mathstat/uniformdistribution.hpp"
-#include <ctime>
 
 namespace MathStat {
-	UniformDistribution::UniformDistribution(double min, double max, bool randomize):d(min, max) {
-		if (randomize) {
-			engine.seed(time(0));
-		}
+	UniformDistribution::UniformDistribution(double min, double max, bool randomize)
+		: Distribution(randomize ? RandomSeed() : 0)
+		, _min(min)
+		, _width(max - min) {
 	}
-	double UniformDistribution::getDouble() {
-		return d(engine);
+	double UniformDistribution::At(uint64_t index) const {
+		const Philox::Block bits = Bits(index);
+		return _min + _width*Unit(bits[0], bits[1]);
 	}
 }
@@ -4,17 +4,17 @@
 #ifndef MATHSTAT_UNIFORMDISTRIBUTION_HPP
 #define MATHSTAT_UNIFORMDISTRIBUTION_HPP
 
-#include <random>
 #include "mathstat/distribution.hpp"
 
 namespace MathStat {
 	class UniformDistribution: public Distribution {
 		public:
+			// not randomized distribution starts from seed 0, see Seed()
 			UniformDistribution(double min=0., double max=1., bool randomize=true);
-			double getDouble() override;
+			double At(uint64_t index) const override;
 		private:
-			std::default_random_engine engine;
-			std::uniform_real_distribution<double> d;
+			double _min;
+			double _width;
 	};
 }
 
@@ -0,0 +1,107 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef NN_ACTIVATION_HPP
+#define NN_ACTIVATION_HPP
+
+#include "linalg/isa.hpp"
+#include "linalg/simd.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+	Activation policies for NN::TPerceptron. Every policy works on whole arrays:
+		Forward(x, rows, cols, ld) - replaces x by f(x) in place;
+		Backward(y, e, g, rows, cols, ld, scale) - g = scale * (df/dx)^T e, where y = f(x) is
+			the output of Forward (derivatives are expressed through it); g may alias e.
+	Rows of all arrays are ld >= cols elements apart, padding is not touched. Rows matter
+	only for softmax, the rest of the policies are element-wise.
+	The loops have no calls and no data dependent branches, so they are vectorized; they are
+	built per instruction set (nn/activationkernels.hpp, linalg/isa.hpp) and the policies below
+	call the active one.
+*/
+namespace NN {
+	namespace Activation {
+		template <class NUMBER> struct ExpTraits;
+		template <> struct ExpTraits<float> {
+			using Bits = int32_t;
+			static constexpr int MANTISSA = 23;
+			static constexpr int BIAS = 127;
+			static constexpr float MIN = -87.3f;
+			static constexpr float MAX = 88.37f; // 2^n stays below the exponent of inf
+			static constexpr float ROUND = 12582912.f; // 1.5 * 2^23
+			static constexpr int ORDER = 7;
+		};
+		template <> struct ExpTraits<double> {
+			using Bits = int64_t;
+			static constexpr int MANTISSA = 52;
+			static constexpr int BIAS = 1023;
+			static constexpr double MIN = -708.3;
+			static constexpr double MAX = 709.08;
+			static constexpr double ROUND = 6755399441055744.; // 1.5 * 2^52
+			static constexpr int ORDER = 11;
+		};
+
+		// element-wise loops run over dense arrays as one row
+		struct Rows {
+			size_t count;
+			size_t n; // elements of every row
+			Rows(size_t rows, size_t cols, size_t ld)
+				: count((ld == cols) ? 1 : rows)
+				, n((ld == cols) ? rows*cols : cols) {
+			}
+		};
+	}
+}
+
+#define LINALG_KERNELS "nn/activationkernels.hpp"
+#include "linalg/multiversion.hpp"
+#undef LINALG_KERNELS
+
+namespace NN {
+	namespace Activation {
+		struct Sigmoid {
+			template <class NUMBER> static void Forward(NUMBER *x, size_t rows, size_t cols, size_t ld) {
+				LINALG_DISPATCH(Sigmoid::Forward(x, rows, cols, ld));
+			}
+			template <class NUMBER> static void Backward(const NUMBER *y, const NUMBER *e, NUMBER *g, size_t rows, size_t cols, size_t ld, NUMBER scale) {
+				LINALG_DISPATCH(Sigmoid::Backward(y, e, g, rows, cols, ld, scale));
+			}
+		};
+
+		struct Tanh {
+			template <class NUMBER> static void Forward(NUMBER *x, size_t rows, size_t cols, size_t ld) {
+				LINALG_DISPATCH(Tanh::Forward(x, rows, cols, ld));
+			}
+			template <class NUMBER> static void Backward(const NUMBER *y, const NUMBER *e, NUMBER *g, size_t rows, size_t cols, size_t ld, NUMBER scale) {
+				LINALG_DISPATCH(Tanh::Backward(y, e, g, rows, cols, ld, scale));
+			}
+		};
+
+		// slope of the negative part is SLOPE_PERMILLE/1000, LeakyReLU<0> is plain ReLU
+		template <int SLOPE_PERMILLE = 10> struct LeakyReLU {
+			static_assert(SLOPE_PERMILLE >= 0, "negative slope must be non-negative");
+			template <class NUMBER> static void Forward(NUMBER *x, size_t rows, size_t cols, size_t ld) {
+				LINALG_DISPATCH(LeakyReLU<SLOPE_PERMILLE>::Forward(x, rows, cols, ld));
+			}
+			template <class NUMBER> static void Backward(const NUMBER *y, const NUMBER *e, NUMBER *g, size_t rows, size_t cols, size_t ld, NUMBER scale) {
+				LINALG_DISPATCH(LeakyReLU<SLOPE_PERMILLE>::Backward(y, e, g, rows, cols, ld, scale));
+			}
+		};
+		using ReLU = LeakyReLU<0>;
+
+		// normalized exponent over every row, meant for the output layer
+		struct Softmax {
+			template <class NUMBER> static void Forward(NUMBER *x, size_t rows, size_t cols, size_t ld) {
+				LINALG_DISPATCH(Softmax::Forward(x, rows, cols, ld));
+			}
+			template <class NUMBER> static void Backward(const NUMBER *y, const NUMBER *e, NUMBER *g, size_t rows, size_t cols, size_t ld, NUMBER scale) {
+				LINALG_DISPATCH(Softmax::Backward(y, e, g, rows, cols, ld, scale));
+			}
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,155 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+// activation kernels of one instruction set, included by nn/activation.hpp via linalg/multiversion.hpp
+namespace NN {
+	namespace Activation {
+		namespace LINALG_ISA {
+			// 1 + r/K*(1 + r/(K+1)*(...)), unrolled at compile time to keep callers' loops branchless
+			template <class NUMBER, int K, int ORDER> inline NUMBER ExpTaylor(NUMBER r) {
+				if constexpr (K > ORDER) {
+					return NUMBER(1);
+				} else {
+					return NUMBER(1) + r*NUMBER(1./K)*ExpTaylor<NUMBER, K + 1, ORDER>(r);
+				}
+			}
+
+			// exp(x) = 2^n * exp(r), |r| <= ln2/2, exp(r) by Taylor polynomial of ORDER degree.
+			// The relative error is below 1e-7 for float and 1e-14 for double (measured over the
+			// whole range), arguments are clamped to the range where 2^n and so the result are
+			// finite normal numbers.
+			template <class NUMBER> inline NUMBER FastExp(NUMBER x) {
+				using T = ExpTraits<NUMBER>;
+				const NUMBER LOG2E = NUMBER(1.4426950408889634);
+				const NUMBER LN2_HI = NUMBER(0.693145751953125);
+				const NUMBER LN2_LO = NUMBER(1.4286068203094172e-06);
+				x = (x < NUMBER(T::MIN)) ? NUMBER(T::MIN) : x;
+				x = (x > NUMBER(T::MAX)) ? NUMBER(T::MAX) : x;
+				const NUMBER n = (x*LOG2E + T::ROUND) - T::ROUND;
+				const NUMBER r = (x - n*LN2_HI) - n*LN2_LO;
+				const NUMBER p = ExpTaylor<NUMBER, 1, T::ORDER>(r);
+				const typename T::Bits bits = (static_cast<typename T::Bits>(n) + T::BIAS) << T::MANTISSA;
+				NUMBER scale;
+				std::memcpy(&scale, &bits, sizeof(scale));
+				return p*scale;
+			}
+
+			struct Sigmoid {
+				template <class NUMBER> static void Forward(NUMBER *x, size_t rows, size_t cols, size_t ld) {
+					const Rows rs(rows, cols, ld);
+					for (size_t r = 0; r < rs.count; ++r) {
+						NUMBER *xr = x + r*ld;
+						LINALG_PRAGMA_SIMD
+						for (size_t i = 0; i < rs.n; ++i) {
+							xr[i] = NUMBER(1)/(NUMBER(1) + FastExp(-xr[i]));
+						}
+					}
+				}
+				template <class NUMBER> static void Backward(const NUMBER *y, const NUMBER *e, NUMBER *g, size_t rows, size_t cols, size_t ld, NUMBER scale) {
+					const Rows rs(rows, cols, ld);
+					for (size_t r = 0; r < rs.count; ++r) {
+						const NUMBER *yr = y + r*ld;
+						const NUMBER *er = e + r*ld;
+						NUMBER *gr = g + r*ld;
+						LINALG_PRAGMA_SIMD
+						for (size_t i = 0; i < rs.n; ++i) {
+							gr[i] = er[i]*yr[i]*(NUMBER(1) - yr[i])*scale;
+						}
+					}
+				}
+			};
+
+			struct Tanh {
+				template <class NUMBER> static void Forward(NUMBER *x, size_t rows, size_t cols, size_t ld) {
+					const Rows rs(rows, cols, ld);
+					for (size_t r = 0; r < rs.count; ++r) {
+						NUMBER *xr = x + r*ld;
+						LINALG_PRAGMA_SIMD
+						for (size_t i = 0; i < rs.n; ++i) {
+							xr[i] = NUMBER(2)/(NUMBER(1) + FastExp(NUMBER(-2)*xr[i])) - NUMBER(1);
+						}
+					}
+				}
+				template <class NUMBER> static void Backward(const NUMBER *y, const NUMBER *e, NUMBER *g, size_t rows, size_t cols, size_t ld, NUMBER scale) {
+					const Rows rs(rows, cols, ld);
+					for (size_t r = 0; r < rs.count; ++r) {
+						const NUMBER *yr = y + r*ld;
+						const NUMBER *er = e + r*ld;
+						NUMBER *gr = g + r*ld;
+						LINALG_PRAGMA_SIMD
+						for (size_t i = 0; i < rs.n; ++i) {
+							gr[i] = er[i]*(NUMBER(1) - yr[i]*yr[i])*scale;
+						}
+					}
+				}
+			};
+
+			template <int SLOPE_PERMILLE = 10> struct LeakyReLU {
+				template <class NUMBER> static void Forward(NUMBER *x, size_t rows, size_t cols, size_t ld) {
+					const Rows rs(rows, cols, ld);
+					const NUMBER slope = NUMBER(SLOPE_PERMILLE)/NUMBER(1000);
+					for (size_t r = 0; r < rs.count; ++r) {
+						NUMBER *xr = x + r*ld;
+						LINALG_PRAGMA_SIMD
+						for (size_t i = 0; i < rs.n; ++i) {
+							xr[i] = (xr[i] > NUMBER(0)) ? xr[i] : slope*xr[i];
+						}
+					}
+				}
+				template <class NUMBER> static void Backward(const NUMBER *y, const NUMBER *e, NUMBER *g, size_t rows, size_t cols, size_t ld, NUMBER scale) {
+					const Rows rs(rows, cols, ld);
+					const NUMBER slope = NUMBER(SLOPE_PERMILLE)/NUMBER(1000);
+					for (size_t r = 0; r < rs.count; ++r) {
+						const NUMBER *yr = y + r*ld;
+						const NUMBER *er = e + r*ld;
+						NUMBER *gr = g + r*ld;
+						LINALG_PRAGMA_SIMD
+						for (size_t i = 0; i < rs.n; ++i) {
+							gr[i] = er[i]*((yr[i] > NUMBER(0)) ? scale : slope*scale);
+						}
+					}
+				}
+			};
+
+			struct Softmax {
+				template <class NUMBER> static void Forward(NUMBER *x, size_t rows, size_t cols, size_t ld) {
+					for (size_t r = 0; r < rows; ++r) {
+						NUMBER *xr = x + r*ld;
+						NUMBER top = xr[0];
+						for (size_t i = 1; i < cols; ++i) {
+							top = std::max(top, xr[i]);
+						}
+						NUMBER sum = 0;
+						LINALG_PRAGMA_SIMD_REDUCTION(+, sum)
+						for (size_t i = 0; i < cols; ++i) {
+							xr[i] = FastExp(xr[i] - top);
+							sum += xr[i];
+						}
+						const NUMBER norm = NUMBER(1)/sum;
+						LINALG_PRAGMA_SIMD
+						for (size_t i = 0; i < cols; ++i) {
+							xr[i] *= norm;
+						}
+					}
+				}
+				// Jacobian of softmax is diag(y) - y y^T, so g = y * (e - dot(e, y))
+				template <class NUMBER> static void Backward(const NUMBER *y, const NUMBER *e, NUMBER *g, size_t rows, size_t cols, size_t ld, NUMBER scale) {
+					for (size_t r = 0; r < rows; ++r) {
+						const NUMBER *yr = y + r*ld;
+						const NUMBER *er = e + r*ld;
+						NUMBER *gr = g + r*ld;
+						NUMBER dot = 0;
+						LINALG_PRAGMA_SIMD_REDUCTION(+, dot)
+						for (size_t i = 0; i < cols; ++i) {
+							dot += er[i]*yr[i];
+						}
+						LINALG_PRAGMA_SIMD
+						for (size_t i = 0; i < cols; ++i) {
+							gr[i] = yr[i]*(er[i] - dot)*scale;
+						}
+					}
+				}
+			};
+		}
+	}
+}
@@ -0,0 +1,178 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef NN_DATAPARALLELTRAINER_HPP
+#define NN_DATAPARALLELTRAINER_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NN {
+	/*
+		Data-parallel mini-batch training of a TPerceptron. Every batch is split into
+		equal contiguous slices, one per worker; workers are persistent threads (the
+		calling thread is worker 0) with their own workspace and gradient buffers.
+		Deterministic mode sums gradients of workers in worker order, every worker
+		summing its own slice of the parameters, so the result does not depend on
+		thread timing. Hogwild mode lets every worker add its gradients to the shared
+		parameters as soon as they are ready, without waiting for the others: worker w
+		applies slices w, w + 1, ... of the parameters in turn, each under its own lock, so
+		updates are never lost and workers rarely meet on a slice. The race Hogwild accepts
+		remains: forward and backward passes of other workers read the parameters (and,
+		with compact weights, the converted copies of weights) while they are updated, so
+		a worker may see a mix of old and new values of a batch.
+	*/
+	template <class PERCEPTRON> class TDataParallelTrainer {
+		public:
+			using Perceptron = PERCEPTRON;
+			using Matrix = typename Perceptron::Matrix;
+			using Sample = typename Perceptron::Sample;
+			using Workspace = typename Perceptron::Workspace;
+			using Gradients = typename Perceptron::Gradients;
+			enum class Mode {
+				Deterministic,
+				Hogwild
+			};
+
+			TDataParallelTrainer(Perceptron &net, size_t threads, size_t batchCapacity, Mode mode=Mode::Deterministic)
+				: _net(net)
+				, _mode(mode)
+				, _workers(std::max<size_t>(1, threads))
+				, _grads(_workers.size())
+				, _sliceLocks(_workers.size())
+				, _samples(nullptr)
+				, _generation(0)
+				, _pending(0)
+				, _stopping(false) {
+				_net.Materialize(); // workers read the network's own tensors
+				const size_t slice = (batchCapacity + _workers.size() - 1)/_workers.size();
+				for (size_t i = 0; i < _workers.size(); ++i) {
+					_workers[i].Resize(_net.Topology(), slice);
+					_grads[i].Resize(_net.Topology(), _net.HugePages());
+				}
+				_output.Resize(batchCapacity, _net.OutSize());
+				for (size_t i = 1; i < _workers.size(); ++i) {
+					_threads.emplace_back(&TDataParallelTrainer::_loop, this, i);
+				}
+			}
+			~TDataParallelTrainer() {
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_stopping = true;
+					_startCV.notify_all();
+				}
+				for (std::thread &t: _threads) {
+					t.join();
+				}
+			}
+			TDataParallelTrainer(const TDataParallelTrainer &) = delete;
+			TDataParallelTrainer &operator = (const TDataParallelTrainer &) = delete;
+
+			size_t Threads() const {
+				return _workers.size();
+			}
+			// Same contract as TPerceptron::TrainBatch: one update per batch,
+			// returns B x OutSize outputs computed before the update.
+			const Matrix &TrainBatch(const std::vector<Sample> &samples) {
+				if (1 == _workers.size()) {
+					return _net.TrainBatch(samples);
+				}
+				_samples = &samples;
+				_output.Resize(samples.size(), _net.OutSize());
+				_run([this](size_t w) {
+					_accumulate(w);
+				});
+				if (Mode::Deterministic == _mode) {
+					_run([this](size_t w) {
+						_net.ApplyGradients(_grads.data(), _grads.size(), w, _workers.size());
+					});
+				}
+				_samples = nullptr;
+				return _output;
+			}
+
+		private:
+			void _accumulate(size_t w) {
+				Workspace &ws = _workers[w];
+				Gradients &grads = _grads[w];
+				const size_t batch = _samples->size();
+				const size_t begin = batch*w/_workers.size();
+				const size_t end = batch*(w + 1)/_workers.size();
+				grads.Zero();
+				if (begin < end) {
+					_net.AccumulateGradients(*_samples, begin, end, ws, grads);
+					const Matrix &out = ws.batchLayer.back();
+					for (size_t r = 0; r < out.Rows(); ++r) {
+						std::copy(out.RowData(r), out.RowData(r) + out.Cols(), _output.RowData(begin + r));
+					}
+				}
+				if (Mode::Hogwild == _mode) {
+					const size_t n = _workers.size();
+					for (size_t k = 0; k < n; ++k) {
+						const size_t slice = (w + k) % n;
+						std::unique_lock<std::mutex> lock(_sliceLocks[slice]);
+						_net.ApplyGradients(&grads, 1, slice, n);
+					}
+				}
+			}
+			// runs job(w) on every worker and waits for all of them
+			void _run(const std::function<void(size_t)> &job) {
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_job = job;
+					_pending = _workers.size() - 1;
+					_generation++;
+					_startCV.notify_all();
+				}
+				job(0);
+				std::unique_lock<std::mutex> lock(_mutex);
+				_doneCV.wait(lock, [this]() {
+					return 0 == _pending;
+				});
+			}
+			void _loop(size_t w) {
+				size_t seen = 0;
+				while (true) {
+					std::function<void(size_t)> job;
+					{
+						std::unique_lock<std::mutex> lock(_mutex);
+						_startCV.wait(lock, [this, seen]() {
+							return _stopping || (_generation != seen);
+						});
+						if (_stopping) {
+							break;
+						}
+						seen = _generation;
+						job = _job;
+					}
+					job(w);
+					std::unique_lock<std::mutex> lock(_mutex);
+					if (0 == --_pending) {
+						_doneCV.notify_one();
+					}
+				}
+			}
+
+			Perceptron &_net;
+			Mode _mode;
+			std::vector<Workspace> _workers;
+			std::vector<Gradients> _grads;
+			std::vector<std::mutex> _sliceLocks; // Hogwild updates of parameter slices
+			Matrix _output;
+			const std::vector<Sample> *_samples;
+			std::function<void(size_t)> _job;
+			size_t _generation;
+			size_t _pending;
+			bool _stopping;
+			std::mutex _mutex;
+			std::condition_variable _startCV;
+			std::condition_variable _doneCV;
+			std::vector<std::thread> _threads;
+	};
+}
+
+#endif
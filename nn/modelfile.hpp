@@ -0,0 +1,75 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef NN_MODELFILE_HPP
+#define NN_MODELFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace NN {
+	/*
+		Model file of a perceptron:
+			header;
+			topology, uint64 per layer;
+			biases of every layer (1 x N), then weights of every layer (N x M), row-major.
+		The topology and every tensor start at an offset aligned to MODEL_ALIGN, so tensors
+		of a memory-mapped file are used in place. The checksum is taken over the topology
+		and the tensors (without padding) in file order by IO::Checksum.
+		Files without the magic are read as the original format: uint32 layer count,
+		uint32 per layer, then all numbers densely in the same order.
+	*/
+	static constexpr size_t MODEL_ALIGN = 64;
+	static constexpr uint32_t MODEL_VERSION = 1;
+	static constexpr uint32_t MODEL_ENDIAN = 0x01020304;
+	static constexpr char MODEL_MAGIC[8] = {'P', 'C', 'P', 'T', 'M', 'O', 'D', 'L'};
+
+	struct ModelHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t endian;
+		uint32_t numberSize; // sizeof(NUMBER)
+		uint32_t layers;
+		uint64_t topologyOffset;
+		uint64_t size; // of the whole file
+		uint64_t checksum;
+	};
+
+	// offsets and sizes (in bytes) of the tensors of a topology in file order
+	struct ModelLayout {
+		std::vector<uint64_t> offset;
+		std::vector<uint64_t> bytes;
+		uint64_t size;
+
+		static uint64_t AlignUp(uint64_t v) {
+			return (v + MODEL_ALIGN - 1)/MODEL_ALIGN*MODEL_ALIGN;
+		}
+		// false if the sizes overflow
+		bool Build(const std::vector<size_t> &topology, size_t numberSize) {
+			bool res = true;
+			const uint64_t LIMIT = std::numeric_limits<uint64_t>::max()/4;
+			offset.clear();
+			bytes.clear();
+			size = AlignUp(sizeof(ModelHeader));
+			size = AlignUp(size + topology.size()*sizeof(uint64_t));
+			for (size_t i = 0; res && (i < topology.size()); ++i) {
+				bytes.push_back(uint64_t(topology[i])*numberSize);
+				res = topology[i] < LIMIT/numberSize;
+			}
+			for (size_t i = 0; res && (i + 1 < topology.size()); ++i) {
+				res = (topology[i + 1] == 0) || (topology[i] < LIMIT/numberSize/topology[i + 1]);
+				bytes.push_back(uint64_t(topology[i])*topology[i + 1]*numberSize);
+			}
+			for (size_t i = 0; res && (i < bytes.size()); ++i) {
+				offset.push_back(size);
+				size = AlignUp(size + bytes[i]);
+				res = size < LIMIT;
+			}
+			return res;
+		}
+	};
+}
+
+#endif
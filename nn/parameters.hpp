@@ -0,0 +1,126 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef NN_PARAMETERS_HPP
+#define NN_PARAMETERS_HPP
+
+#include "linalg/arena.hpp"
+#include "linalg/view.hpp"
+#include "nn/modelfile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace NN {
+	// Biases and weights of every layer of a topology, carved out of one arena in the order
+	// and alignment of tensors of the model file (nn/modelfile.hpp): biases of all layers,
+	// then weights. Gaps between tensors stay zero, so the whole set is copied, zeroed,
+	// reduced or written to a file by one pass over Data() ... Data() + Size().
+	// A set may hold only weight layers [first, last) of the topology (weights of k, biases of
+	// k + 1), packed in the same order and alignment; tensors of other layers are empty views.
+	template <class NUMBER> class TParameters {
+		public:
+			using Number = NUMBER;
+			using View = LinAlg::MatrixView<Number>;
+
+			std::vector<View> weight; // InSize(i) x OutSize(i + 1)
+			std::vector<View> bias; // 1 x N per layer
+
+			TParameters()
+				: _first(0)
+				, _last(0)
+				, _hugePages(false) {
+			}
+			TParameters(const TParameters &other)
+				: TParameters() {
+				*this = other;
+			}
+			// the arena moves with its memory, so views stay valid
+			TParameters(TParameters &&) = default;
+			TParameters &operator = (TParameters &&) = default;
+			TParameters &operator = (const TParameters &other) {
+				if (this != &other) {
+					Resize(other._topology, other._first, other._last, other._hugePages);
+					if (0 != Size()) {
+						std::memcpy(Data(), other.Data(), Size()*sizeof(Number));
+					}
+				}
+				return *this;
+			}
+
+			// zeroes all tensors, the arena is kept if the layout does not change
+			void Resize(const std::vector<size_t> &topology, bool hugePages=false) {
+				Resize(topology, 0, topology.empty() ? 0 : topology.size() - 1, hugePages);
+			}
+			// Tensors of weight layers [first, last) only; biases of the input layer go with the
+			// layer 0, so the whole range is laid out as the model file.
+			void Resize(const std::vector<size_t> &topology, size_t first, size_t last, bool hugePages=false) {
+				if ((topology != _topology) || (first != _first) || (last != _last) || (hugePages != _hugePages) || (nullptr == Data())) {
+					ModelLayout layout;
+					if (!layout.Build(topology, sizeof(Number))) {
+						throw std::runtime_error("Topology is too large");
+					}
+					if ((first > last) || (last + 1 > std::max<size_t>(1, topology.size()))) {
+						throw std::runtime_error("Layer range out of topology");
+					}
+					// offsets of the set's tensors, the rest are -1
+					const size_t layers = topology.size();
+					std::vector<uint64_t> offset(layout.offset.size(), ~uint64_t(0));
+					uint64_t size = 0;
+					for (size_t t = 0; t < offset.size(); ++t) {
+						const bool own = (t < layers) ? (((first < t) || (0 == first)) && (t <= last)) : ((first <= t - layers) && (t - layers < last));
+						if (own) {
+							offset[t] = size;
+							size = ModelLayout::AlignUp(size + layout.bytes[t]);
+						}
+					}
+					_arena = LinAlg::Arena(size, hugePages);
+					_topology = topology;
+					_first = first;
+					_last = last;
+					_hugePages = hugePages;
+					bias.clear();
+					weight.clear();
+					Number *data = Data();
+					for (size_t i = 0; i < layers; ++i) {
+						bias.push_back((~uint64_t(0) != offset[i]) ? View(data + offset[i]/sizeof(Number), 1, topology[i]) : View());
+					}
+					for (size_t i = 0; i + 1 < layers; ++i) {
+						weight.push_back((~uint64_t(0) != offset[layers + i]) ? View(data + offset[layers + i]/sizeof(Number), topology[i], topology[i + 1]) : View());
+					}
+				} else {
+					Zero();
+				}
+			}
+			void Zero() {
+				std::memset(_arena.Data(), 0, _arena.Bytes());
+			}
+
+			const std::vector<size_t> &Topology() const {
+				return _topology;
+			}
+			Number *Data() {
+				return static_cast<Number *>(_arena.Data());
+			}
+			const Number *Data() const {
+				return static_cast<const Number *>(_arena.Data());
+			}
+			// numbers of all tensors with gaps between them
+			size_t Size() const {
+				return _arena.Bytes()/sizeof(Number);
+			}
+			bool HugePages() const {
+				return _hugePages;
+			}
+
+		private:
+			std::vector<size_t> _topology;
+			size_t _first; // weight layers [_first, _last) of the topology
+			size_t _last;
+			LinAlg::Arena _arena;
+			bool _hugePages;
+	};
+}
+
+#endif
@@ -4,22 +4,49 @@
 #ifndef NN_PERCEPTRON_HPP
 #define NN_PERCEPTRON_HPP
 
+#include "mathstat/normaldistribution.hpp"
 #include "mathstat/uniformdistribution.hpp"
 #include "linalg/linalg.hpp"
-#include "io/filereader.hpp"
+#include "profile/profiler.hpp"
+#include "nn/activation.hpp"
+#include "nn/modelfile.hpp"
+#include "nn/parameters.hpp"
+#include "io/checksum.hpp"
 #include "io/filewriter.hpp"
+#include "io/mappedfile.hpp"
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <type_traits>
 
 namespace NN {
-	static MathStat::UniformDistribution ud(-1., 1.);
+	enum class Initializer {
+		Uniform, // weights and biases of U(-1, 1)
+		XavierNormal, // weights of N(0, 2/(fan_in + fan_out)), zero biases
+		HeNormal // weights of N(0, 2/fan_in), zero biases
+	};
 
-	template <class NUMBER> class TPerceptron {
+	// ACTIVATION is applied to hidden layers and OUTPUT_ACTIVATION to the output one,
+	// both are policies from nn/activation.hpp.
+	// WEIGHT_STORAGE other than NUMBER (e.g. LinAlg::bf16) makes forward passes read a compact
+	// copy of weights, products are still accumulated in NUMBER. Updates are applied to the
+	// NUMBER master weights, the compact copy is refreshed from them after every update.
+	template <class NUMBER, class ACTIVATION = Activation::Sigmoid, class OUTPUT_ACTIVATION = ACTIVATION, class WEIGHT_STORAGE = NUMBER> class TPerceptron {
 		public:
 			using LA = LinearAlgebra<NUMBER>;
 			using Number = typename LA::Number;
 			using Vector = typename LA::Vector;
 			using Matrix = typename LA::Matrix;
-			using UnaryFunction = NUMBER(*)(const Number &);
-			using UnaryInplaceFunction = void (*)(Number &);
+			using ConstMatrixView = typename LA::ConstMatrixView;
+			using SparseMatrix = typename LA::SparseMatrix;
+			using HiddenActivation = ACTIVATION;
+			using OutputActivation = OUTPUT_ACTIVATION;
+			using WeightStorage = WEIGHT_STORAGE;
+			using StorageMatrix = LinAlg::Matrix<WeightStorage, Number>;
+			static constexpr bool COMPACT_WEIGHTS = !std::is_same<WeightStorage, Number>::value;
+			// inputs with at most this share of nonzeros are multiplied by the first layer's
+			// weights with the sparse kernels, which touch only weight rows of nonzero inputs
+			static constexpr double SPARSE_DENSITY = 0.2;
 
 			struct Sample {
 				Vector input;
@@ -31,182 +58,760 @@ namespace NN {
 				}
 			};
 
-			static void RND(NUMBER &n) {
-				n = ud.getDouble();
-			}
-			void BuildTopology(const std::vector<size_t> topology) {
-				size_t layerCount = topology.size();
-				_layer.resize(layerCount);
-				_bias.resize(layerCount);
-				_weight.resize(layerCount-1);
+			// Scratch state of forward and backward passes. It is sized once for a topology
+			// and a batch capacity, so the passes themselves do not allocate memory.
+			struct Workspace {
+				std::vector<Matrix> layer; // activations of a single sample, 1 x N per layer
+				std::vector<Vector> errors; // errors of a single sample per layer
+				Vector gradients;
+				Vector output;
+				std::vector<Matrix> batchLayer; // activations of a batch, B x N per layer, rows padded to cache lines
+				std::vector<Matrix> batchErrors; // errors (and then gradients) of a batch, B x N per layer, padded as well
+				SparseMatrix sparseSample; // nonzero inputs of the single sample, no rows if it is dense
+				SparseMatrix sparseBatch; // the same for the batch
 
-				for (size_t i = 0; i < layerCount; i++) {
-					if (i < topology.size() - 1) {
-						_weight[i].Resize(topology[i], topology[i+1]);
+				void Resize(const std::vector<size_t> &topology, size_t batchCapacity) {
+					size_t layerCount = topology.size();
+					layer.resize(layerCount);
+					errors.resize(layerCount);
+					batchLayer.resize(layerCount);
+					batchErrors.resize(layerCount);
+					size_t widest = 0;
+					for (size_t i = 0; i < layerCount; i++) {
+						layer[i].Resize(1, topology[i]);
+						errors[i].resize(topology[i]);
+						batchLayer[i].Resize(batchCapacity, topology[i], Matrix::ALIGNED);
+						batchErrors[i].Resize(batchCapacity, topology[i], Matrix::ALIGNED);
+						widest = std::max(widest, topology[i]);
+					}
+					gradients.resize(widest);
+					output.resize(layerCount ? topology.back() : 0);
+					const size_t inputs = layerCount ? topology[0] : 0;
+					sparseSample.Reserve(1, inputs);
+					sparseBatch.Reserve(batchCapacity, batchCapacity*inputs);
+				}
+				// only shrinks or grows the row count, storage is reused below the capacity
+				void ResizeBatch(size_t batch) {
+					for (size_t i = 0; i < layer.size(); i++) {
+						batchLayer[i].Resize(batch, layer[i].Cols());
+						batchErrors[i].Resize(batch, layer[i].Cols());
 					}
-					_bias[i].Resize(1, topology[i]);
-					_layer[i].Resize(1, topology[i]);
 				}
+			};
+
+			// Weights and biases of the network (and their gradients) live in one arena,
+			// the tensors are views into it.
+			using Parameters = TParameters<Number>;
+			using Gradients = Parameters;
+
+			void BuildTopology(const std::vector<size_t> topology, size_t batchCapacity = 1) {
+				_releaseMapping();
+				_topology = topology;
+				_params.Resize(_topology, _hugePages);
+				if (COMPACT_WEIGHTS) {
+					_storedWeight.resize(_params.weight.size());
+					_syncWeights();
+				}
+				_ws.Resize(_topology, batchCapacity);
 			}
-			void Init() {
-				for (Matrix &v: _bias) {
-					v.ApplyForEach(RND, true);
+			// Backs parameters by huge pages (gradients of a trainer follow), a built network
+			// keeps its values.
+			void UseHugePages(bool on) {
+				_hugePages = on;
+				if (!IsMapped() && (on != _params.HugePages()) && !_topology.empty()) {
+					Parameters params = _params;
+					_params.Resize(_topology, _hugePages);
+					std::memcpy(_params.Data(), params.Data(), _params.Size()*sizeof(Number));
 				}
-				for (Matrix &m: _weight) {
-					m.ApplyForEach(RND, true);
+			}
+			bool HugePages() const {
+				return _hugePages;
+			}
+			void Init(Initializer initializer = Initializer::Uniform) {
+				Init(MathStat::Distribution::RandomSeed(), initializer);
+			}
+			// Parameters are numbered through all biases and then all weights, the n-th one
+			// takes the n-th value of the seed's sequence, so the result is bit-identical
+			// however the filling is split between threads.
+			void Init(uint64_t seed, Initializer initializer = Initializer::Uniform) {
+				if (IsMapped()) {
+					BuildTopology(_topology);
+				}
+				MathStat::UniformDistribution uniform(-1., 1., false);
+				uniform.Seed(seed);
+				uint64_t index = 0;
+				for (auto &b: _params.bias) {
+					const size_t n = b.Rows()*b.Cols();
+					if (Initializer::Uniform == initializer) {
+						uniform.Fill(b.Data(), n, index, true);
+					} else {
+						std::fill(b.Data(), b.Data() + n, Number(0));
+					}
+					index += n;
 				}
+				for (auto &w: _params.weight) {
+					const size_t n = w.Rows()*w.Cols();
+					if (Initializer::Uniform == initializer) {
+						uniform.Fill(w.Data(), n, index, true);
+					} else {
+						const double fans = (Initializer::XavierNormal == initializer) ? (w.Rows() + w.Cols()) : w.Rows();
+						MathStat::NormalDistribution normal(0., std::sqrt(2./fans), false);
+						normal.Seed(seed);
+						normal.Fill(w.Data(), n, index, true);
+					}
+					index += n;
+				}
+				_syncWeights();
 			}
 
 
+			const std::vector<size_t> &Topology() const {
+				return _topology;
+			}
+			// weights of layer i are InSize(i) x OutSize(i+1) matrices, biases are 1 x N rows;
+			// a mapped network has to be materialized first
+			const std::vector<typename Parameters::View> &Weights() const {
+				_checkOwned();
+				return _params.weight;
+			}
+			const std::vector<typename Parameters::View> &Biases() const {
+				_checkOwned();
+				return _params.bias;
+			}
+			// all of them in one block
+			const Parameters &Params() const {
+				_checkOwned();
+				return _params;
+			}
+			// memory read by forward passes for weights
+			size_t WeightBytes() const {
+				size_t res = 0;
+				for (size_t i = 0; i + 1 < _topology.size(); ++i) {
+					res += _topology[i]*_topology[i + 1]*sizeof(WeightStorage);
+				}
+				return res;
+			}
 			size_t InSize() const {
 				size_t res = 0;
 				do {
-					if (_layer.empty()) {
+					if (_topology.empty()) {
 						break;
 					}
-					res = _layer.front().Size();
+					res = _topology.front();
 				} while (false);
 				return res;
 			}
 			size_t OutSize() const {
 				size_t res = 0;
 				do {
-					if (_layer.empty()) {
+					if (_topology.empty()) {
 						break;
 					}
-					res = _layer.back().Size();
+					res = _topology.back();
 				} while (false);
 				return res;
 			}
 
-			TPerceptron(double learningRate, UnaryInplaceFunction sigmoid, UnaryFunction dsigmoid)
-				: learningRate(learningRate)
-				, activation(sigmoid)
-				, derivative(dsigmoid) {
+			TPerceptron(double learningRate)
+				: learningRate(learningRate) {
+			}
+			// takes effect from the next training call, e.g. for a warm-up of large batches
+			void SetLearningRate(double rate) {
+				learningRate = rate;
+			}
+			double LearningRate() const {
+				return learningRate;
+			}
+
+			const Vector &feedForward(const Vector &input) {
+				return _feedForward(input, _ws, true);
+			}
+			// input is a 1 x InSize sparse row, dense inputs are checked for sparsity as well
+			const Vector &feedForward(const SparseMatrix &input) {
+				return _feedForward(input, _ws, true);
 			}
 
-			Vector feedForward(const Vector &input) {
-				_layer[0] = input;
-				for (size_t i = 1; i < _layer.size(); ++i)  {
-					Matrix &in = _layer[i - 1];
-					Matrix &out = _layer[i];
-					out = in * _weight[i-1] + _bias[i];
-					out.ApplyForEach(activation, true);
+			// Forward pass for a batch of samples, one sample per row of inputs (B x InSize).
+			// Returns B x OutSize matrix of outputs. Inputs may be any view (e.g. RowRange()
+			// of a larger batch), the first layer reads them in place.
+			const Matrix &FeedForwardBatch(ConstMatrixView inputs) {
+				return _predictBatch(inputs, _ws, true);
+			}
+
+			// Reentrant inference: weights are only read and all scratch state lives in ws,
+			// so any number of threads may share one network, each with its own workspace.
+			// The workspace is (re)sized on the first use; the result lives in ws.
+			const Vector &Predict(const Vector &input, Workspace &ws) const {
+				_prepare(ws);
+				return _feedForward(input, ws, false);
+			}
+			// the same on a workspace owned by the calling thread
+			const Vector &Predict(const Vector &input) const {
+				thread_local Workspace ws;
+				return Predict(input, ws);
+			}
+			const Vector &Predict(const SparseMatrix &input, Workspace &ws) const {
+				_prepare(ws);
+				return _feedForward(input, ws, false);
+			}
+			const Vector &Predict(const SparseMatrix &input) const {
+				thread_local Workspace ws;
+				return Predict(input, ws);
+			}
+			const Matrix &PredictBatch(ConstMatrixView inputs, Workspace &ws) const {
+				_prepare(ws);
+				return _predictBatch(inputs, ws, false);
+			}
+			const Matrix &PredictBatch(ConstMatrixView inputs) const {
+				thread_local Workspace ws;
+				return PredictBatch(inputs, ws);
+			}
+			// B x InSize sparse inputs
+			const Matrix &PredictBatch(const SparseMatrix &inputs, Workspace &ws) const {
+				_prepare(ws);
+				if (inputs.Cols() != InSize()) {
+					throw std::runtime_error("Batch input size mismatch");
 				}
-				return _layer[_layer.size() - 1];
+				ws.ResizeBatch(inputs.Rows());
+				ws.sparseBatch = inputs;
+				_feedForwardBatch(ws, ConstMatrixView(), false);
+				return ws.batchLayer.back();
+			}
+			const Matrix &PredictBatch(const SparseMatrix &inputs) const {
+				thread_local Workspace ws;
+				return PredictBatch(inputs, ws);
 			}
 
-			void backpropagation(const Vector &right_answer) {
-				Matrix errors = Matrix::Row(right_answer) - _layer.back();
-				for (int k = _layer.size() - 2; k >= 0; k--) {
-					Matrix &in = _layer[k];
-					Matrix &out = _layer[k + 1];
-					Matrix errorsNext;
-					errorsNext.Resize(in.Size(), 1);
-					Matrix gradients;
-					gradients.Resize(out.Size(), 1);
-					for (size_t i = 0; i < out.Size(); i++) {
-						gradients[i] = errors[i] * derivative(_layer[k + 1][i]) * learningRate;
+			// Trains the network by one mini-batch: gradients of all samples are accumulated
+			// with one matrix-matrix product per layer and applied to weights at once, averaged
+			// over the batch, so a step is as large as the one of a single sample.
+			// Returns B x OutSize matrix of outputs computed before the update.
+			const Matrix &TrainBatch(const std::vector<Sample> &samples) {
+				Materialize();
+				_loadBatch(samples, 0, samples.size(), _ws);
+				_feedForwardBatch(_ws, _ws.batchLayer[0].View(), true);
+				_outputErrors(samples, 0, _ws);
+				// weights are updated right in place, every layer after its error is propagated
+				_backpropagationBatch(_ws, _params, samples.size(), true);
+				_syncWeights(true);
+				return _ws.batchLayer.back();
+			}
+
+			// Forward and backward pass of samples [begin, end) in the caller's workspace.
+			// Gradients (averaged over the whole batch, samples.size()) are added to g and
+			// the network itself is not changed, so it may be
+			// called by several threads at once. Outputs stay in ws.batchLayer.back().
+			void AccumulateGradients(const std::vector<Sample> &samples, size_t begin, size_t end, Workspace &ws, Gradients &g, bool parallel=false) const {
+				_checkOwned();
+				_loadBatch(samples, begin, end, ws);
+				_feedForwardBatch(ws, ws.batchLayer[0].View(), parallel);
+				_outputErrors(samples, begin, ws);
+				_backpropagationBatch(ws, g, samples.size(), parallel);
+			}
+			// Adds grads[0] + ... + grads[count-1] (summed in this order) to the parameters by
+			// one pass over the arena. Only the slice-th of slices equal parts (split at cache
+			// lines) is updated, so disjoint slices may be applied by different threads.
+			void ApplyGradients(const Gradients *grads, size_t count, size_t slice=0, size_t slices=1) {
+				Materialize();
+				const size_t line = LinAlg::Arena::ALIGN/sizeof(Number);
+				const size_t n = _params.Size();
+				const size_t from = std::min(n, n*slice/slices/line*line);
+				const size_t to = (slice + 1 == slices) ? n : std::min(n, n*(slice + 1)/slices/line*line);
+				Number *dst = _params.Data();
+				for (size_t g = 0; g < count; ++g) {
+					const Number *src = grads[g].Data();
+					LINALG_PRAGMA_SIMD
+					for (size_t j = from; j < to; ++j) {
+						dst[j] += src[j];
 					}
-					Matrix deltas;
-					deltas.Resize(_weight[k].Cols(), _weight[k].Rows());
-					for (size_t i = 0; i < out.Size(); i++) {
-						for (size_t j = 0; j < in.Size(); j++) {
-							deltas.at(i, j) = gradients[i] * in[j];
+				}
+				if constexpr (COMPACT_WEIGHTS) { // the part of every weight tensor within the slice
+					for (size_t i = 0; i < _params.weight.size(); ++i) {
+						const Number *w = _params.weight[i].Data();
+						const size_t begin = w - dst;
+						const size_t end = begin + _params.weight[i].Rows()*_params.weight[i].Cols();
+						if ((begin < to) && (from < end)) {
+							const size_t first = std::max(begin, from) - begin;
+							LinAlg::Convert<WeightStorage>(w + first, _storedWeight[i].Data() + first, std::min(end, to) - begin - first);
 						}
 					}
-					for (size_t i = 0; i < in.Size(); i++) {
-						errorsNext[i] = 0;
-						for (size_t j = 0; j < out.Size(); j++) {
-							errorsNext[i] += _weight[k].at(i, j) * errors[j];
+				}
+			}
+
+			// Passes of a pipeline stage (NN::TPipelineTrainer) over weight layers [first, last) for
+			// samples [begin, end). The stage of layer 0 loads the samples into ws, the stage of
+			// the output layer computes output errors, others take activations (and errors) of
+			// their boundary layers from ws. Like AccumulateGradients they change only ws and g.
+			void ForwardLayers(const std::vector<Sample> &samples, size_t begin, size_t end, size_t first, size_t last, Workspace &ws, bool parallel=false) const {
+				_checkOwned();
+				if (0 == first) {
+					_loadBatch(samples, begin, end, ws);
+				}
+				_forwardLayers(ws, ws.batchLayer[first].View(), first, last, parallel);
+				if (last + 1 == _topology.size()) {
+					_outputErrors(samples, begin, ws);
+				}
+			}
+			// Errors of layer first are propagated to ws.batchErrors[first] unless it is the input,
+			// gradients are averaged over batchSize samples.
+			void BackwardLayers(size_t first, size_t last, Workspace &ws, Gradients &g, size_t batchSize, bool parallel=false) const {
+				_checkOwned();
+				_backwardLayers(ws, g, first, last, batchSize, parallel);
+			}
+			// Adds gradients of weight layers [first, last) (weights of k and biases of k + 1) to
+			// the parameters, grads may hold only these layers (TParameters::Resize). Tensors of
+			// disjoint ranges may be updated by different threads.
+			void ApplyLayerGradients(const Gradients &grads, size_t first, size_t last) {
+				Materialize();
+				for (size_t k = first; k < last; ++k) {
+					const typename Parameters::View *to[] = {&_params.weight[k], &_params.bias[k + 1]};
+					const typename Parameters::View *from[] = {&grads.weight[k], &grads.bias[k + 1]};
+					for (size_t t = 0; t < 2; ++t) {
+						Number *dst = to[t]->Data();
+						const Number *src = from[t]->Data();
+						const size_t n = to[t]->Rows()*to[t]->Cols();
+						LINALG_PRAGMA_SIMD
+						for (size_t j = 0; j < n; ++j) {
+							dst[j] += src[j];
 						}
 					}
-					errors = errorsNext;
-					_weight[k] += deltas.Transp();
-					_bias[k+1] += gradients.Transp();
+					if constexpr (COMPACT_WEIGHTS) {
+						const auto &w = _params.weight[k];
+						LinAlg::Convert<WeightStorage>(w.Data(), _storedWeight[k].Data(), w.Rows()*w.Cols());
+					}
+				}
+			}
+
+			void backpropagation(const Vector &right_answer) {
+				Materialize();
+				const std::vector<Matrix> &layer = _ws.layer;
+				Vector &gradients = _ws.gradients;
+				for (size_t i = 0; i < OutSize(); i++) {
+					_ws.errors.back()[i] = right_answer[i] - layer.back().Data()[i];
+				}
+				for (int k = layer.size() - 2; k >= 0; k--) {
+					const Number *in = layer[k].Data();
+					const Number *out = layer[k + 1].Data();
+					const Vector &errors = _ws.errors[k + 1];
+					Vector &errorsNext = _ws.errors[k];
+					const auto &w = _params.weight[k];
+					const size_t inSize = w.Rows();
+					const size_t outSize = w.Cols();
+					_derivative(k + 1, out, errors.data(), gradients.data(), 1, outSize, outSize, Number(learningRate));
+					if ((0 == k) && (0 != _ws.sparseSample.Rows())) { // only weight rows of nonzero inputs change
+						const SparseMatrix &input = _ws.sparseSample;
+						PROFILE_SCOPE(FusedBackward, k + 1, 2*input.NonZeros()*outSize, 2*input.NonZeros()*outSize*sizeof(Number));
+						LinAlg::Sparse::GemmT<Number>(input, outSize, gradients.data(), outSize, w.Data(), w.Cols());
+					} else {
+						PROFILE_SCOPE(FusedBackward, k + 1, ((k > 0) ? 4 : 2)*inSize*outSize, 2*inSize*outSize*sizeof(Number));
+						// error of the previous layer (through weights before update) and weights update in one sweep
+						LinAlg::Gemm::GemvGer<Number>(inSize, outSize, w.Data(), w.Cols(), errors.data(), (k > 0) ? errorsNext.data() : nullptr, in, gradients.data(), true);
+					}
+					Number *b = _params.bias[k + 1].Data();
+					for (size_t j = 0; j < outSize; j++) {
+						b[j] += gradients[j];
+					}
 				}
+				_syncWeights();
 			}
-			bool SaveToFile(const std::string &filename) {
+			// Writes the model file of nn/modelfile.hpp, all tensors (laid out in memory as in
+			// the file) by one write.
+			bool SaveToFile(const std::string &filename) const {
 				bool res = false;
 				do {
-					IO::FileWriter f;
-					auto NumSaver = [&f](NUMBER& v)->void{
-						f.Write(v);
-					};
-					if (!f.Open(filename)) {
+					ModelLayout layout;
+					if (!layout.Build(_topology, sizeof(Number)) || layout.offset.empty()) {
 						break;
 					}
-					_saveTopology(f);
-					for (auto &b : _bias) {
-						b.ApplyForEach(NumSaver);
+					ModelHeader header;
+					std::memset(&header, 0, sizeof(header));
+					std::memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+					header.version = MODEL_VERSION;
+					header.endian = MODEL_ENDIAN;
+					header.numberSize = sizeof(Number);
+					header.layers = _topology.size();
+					header.topologyOffset = ModelLayout::AlignUp(sizeof(header));
+					header.size = layout.size;
+					std::vector<uint64_t> topology(_topology.begin(), _topology.end());
+					std::vector<const Number *> tensors;
+					for (size_t i = 0; i < _topology.size(); ++i) {
+						tensors.push_back(_masterBias(i));
 					}
-					for (auto &w : _weight) {
-						w.ApplyForEach(NumSaver);
+					for (size_t i = 0; i + 1 < _topology.size(); ++i) {
+						tensors.push_back(_masterWeight(i));
 					}
-					res = true;
+					header.checksum = IO::Checksum(topology.data(), topology.size()*sizeof(uint64_t));
+					for (size_t t = 0; t < tensors.size(); ++t) {
+						header.checksum = IO::Checksum(tensors[t], layout.bytes[t], header.checksum);
+					}
+					IO::FileWriter f;
+					const std::vector<uint8_t> padding(MODEL_ALIGN, 0);
+					if (!f.Open(filename) || !f.Write(header) || !f.Write(padding.data(), header.topologyOffset - sizeof(header))) {
+						break;
+					}
+					const uint64_t pos = header.topologyOffset + topology.size()*sizeof(uint64_t);
+					res = f.Write(topology.data(), topology.size()*sizeof(uint64_t)) && f.Write(padding.data(), layout.offset[0] - pos) && f.Write(tensors[0], layout.size - layout.offset[0]);
 				} while (false);
 				return res;
 			}
+			// Reads a model file (or a file of the original format) into the network's own
+			// storage. On failure the network is left as it was.
 			bool LoadFromFile(const std::string &filename) {
 				bool res = false;
 				do {
-					IO::FileReader f;
-					auto NumLoader = [&f](NUMBER& v)->void{
-						f.Read(v);
-					};
-
-					if (!f.Open(filename)) {
+					std::shared_ptr<IO::MappedFile> file = std::make_shared<IO::MappedFile>();
+					std::vector<size_t> topology;
+					std::vector<const Number *> tensors;
+					if (!file->Open(filename) || !_parse(*file, topology, tensors)) {
 						break;
 					}
-					_loadTopology(f);
-					for (auto &b : _bias) {
-						b.ApplyForEach(NumLoader);
+					BuildTopology(topology);
+					if (0 == std::memcmp(file->Data(), MODEL_MAGIC, sizeof(MODEL_MAGIC))) { // the same layout as the arena
+						std::memcpy(_params.Data(), tensors[0], _params.Size()*sizeof(Number));
+					} else {
+						for (size_t i = 0; i < topology.size(); ++i) {
+							std::memcpy(_params.bias[i].Data(), tensors[i], topology[i]*sizeof(Number));
+						}
+						for (size_t i = 0; i + 1 < topology.size(); ++i) {
+							std::memcpy(_params.weight[i].Data(), tensors[topology.size() + i], topology[i]*topology[i + 1]*sizeof(Number));
+						}
 					}
-					for (auto &w : _weight) {
-						w.ApplyForEach(NumLoader);
+					_syncWeights(true);
+					res = true;
+				} while (false);
+				return res;
+			}
+			// Zero-copy load: tensors of a model file are used right in the mapped memory, so it
+			// costs about the page faults of the first pass. The mapped network is read-only:
+			// inference works as usual, the first update (or Materialize()) copies the tensors
+			// into own storage. Files of the original format and networks with compact weights
+			// are loaded by LoadFromFile. Not to be called while other threads use the network.
+			bool MapFromFile(const std::string &filename) {
+				bool res = false;
+				do {
+					std::shared_ptr<IO::MappedFile> file = std::make_shared<IO::MappedFile>();
+					std::vector<size_t> topology;
+					std::vector<const Number *> tensors;
+					if (!file->Open(filename) || !_parse(*file, topology, tensors)) {
+						break;
 					}
+					if (COMPACT_WEIGHTS || (0 != reinterpret_cast<uintptr_t>(file->Data()) % MODEL_ALIGN) || (0 != std::memcmp(file->Data(), MODEL_MAGIC, sizeof(MODEL_MAGIC)))) {
+						res = LoadFromFile(filename);
+						break;
+					}
+					_params = Parameters();
+					_storedWeight.clear();
+					_topology = topology;
+					_mappedBias.assign(tensors.begin(), tensors.begin() + topology.size());
+					_mappedWeight.assign(tensors.begin() + topology.size(), tensors.end());
+					_mapping = file;
+					_ws.Resize(_topology, 1);
 					res = true;
 				} while (false);
 				return res;
 			}
+			bool IsMapped() const {
+				return nullptr != _mapping;
+			}
+			// copies tensors of a mapped network into own storage and releases the file
+			void Materialize() {
+				if (IsMapped()) {
+					// mapped files are of the model format, tensors are laid out as in the arena
+					std::shared_ptr<IO::MappedFile> file = _mapping;
+					const Number *tensors = _mappedBias[0];
+					BuildTopology(_topology);
+					std::memcpy(_params.Data(), tensors, _params.Size()*sizeof(Number));
+				}
+			}
 
 		private:
-			void _saveTopology(IO::FileWriter &f) {
-				do {
-					if (!f.Write<uint32_t>(_layer.size())) {
-						break;
+			// rows of x are ld elements apart
+			void _activate(size_t layer, Number *x, size_t rows, size_t cols, size_t ld) const {
+				PROFILE_SCOPE(Activation, layer, 0, 2*rows*cols*sizeof(Number));
+				if (layer + 1 == _topology.size()) {
+					OutputActivation::Forward(x, rows, cols, ld);
+				} else {
+					HiddenActivation::Forward(x, rows, cols, ld);
+				}
+			}
+			// g = e * f'(y) * rate, rate is the learning rate over the samples gradients are summed of
+			void _derivative(size_t layer, const Number *y, const Number *e, Number *g, size_t rows, size_t cols, size_t ld, Number rate) const {
+				PROFILE_SCOPE(Derivative, layer, 0, 3*rows*cols*sizeof(Number));
+				if (layer + 1 == _topology.size()) {
+					OutputActivation::Backward(y, e, g, rows, cols, ld, rate);
+				} else {
+					HiddenActivation::Backward(y, e, g, rows, cols, ld, rate);
+				}
+			}
+			// products of the network's own passes are dispatched by the autotuner,
+			// serial ones (e.g. from worker threads of a trainer) go straight to the blocked kernel
+			template <class TB> static void _gemm(bool parallel, size_t M, size_t N, size_t K, Number alpha, const Number *A, size_t rsa, size_t csa, const TB *B, size_t rsb, size_t csb, Number beta, Number *C, size_t ldc) {
+				if (parallel) {
+					LinAlg::Autotuner::Instance().Gemm<Number, TB>(M, N, K, alpha, A, rsa, csa, B, rsb, csb, beta, C, ldc);
+				} else {
+					LinAlg::Gemm::Gemm<Number, TB>(M, N, K, alpha, A, rsa, csa, B, rsb, csb, beta, C, ldc, false);
+				}
+			}
+			// tensors of layer i, owned or mapped
+			const Number *_masterWeight(size_t i) const {
+				return IsMapped() ? _mappedWeight[i] : _params.weight[i].Data();
+			}
+			const Number *_masterBias(size_t i) const {
+				return IsMapped() ? _mappedBias[i] : _params.bias[i].Data();
+			}
+			// weights of layer i as read by forward passes
+			const WeightStorage *_forwardWeight(size_t i) const {
+				if constexpr (COMPACT_WEIGHTS) {
+					return _storedWeight[i].Data();
+				} else {
+					return _masterWeight(i);
+				}
+			}
+			void _releaseMapping() {
+				_mapping.reset();
+				_mappedBias.clear();
+				_mappedWeight.clear();
+			}
+			void _checkOwned() const {
+				if (IsMapped()) {
+					throw std::runtime_error("Mapped network is read-only, materialize it first");
+				}
+			}
+			// refreshes the compact copy of weights from the master ones
+			void _syncWeights(bool parallel=false) {
+				if constexpr (COMPACT_WEIGHTS) {
+					for (size_t i = 0; i < _params.weight.size(); ++i) {
+						const auto &w = _params.weight[i];
+						_storedWeight[i].Resize(w.Rows(), w.Cols());
+						LinAlg::Convert<WeightStorage>(w.Data(), _storedWeight[i].Data(), w.Rows()*w.Cols(), parallel);
 					}
-					for (auto &l: _layer) {
-						if (!f.Write<uint32_t>(l.Size())) {
-							break;
+				}
+			}
+			// sizes workspace for the topology unless it already fits
+			void _prepare(Workspace &ws) const {
+				bool fits = (ws.layer.size() == _topology.size());
+				for (size_t i = 0; fits && (i < _topology.size()); ++i) {
+					fits = (ws.layer[i].Cols() == _topology[i]);
+				}
+				if (!fits) {
+					ws.Resize(_topology, 1);
+				}
+			}
+			const Vector &_feedForward(const Vector &input, Workspace &ws, bool parallel) const {
+				if (input.size() != InSize()) {
+					throw std::runtime_error("Input size mismatch");
+				}
+				std::copy(input.begin(), input.end(), ws.layer[0].Data());
+				ws.sparseSample.Gather(ws.layer[0].Data(), 1, InSize(), InSize(), 1, SPARSE_DENSITY);
+				return _forwardSample(ws, parallel);
+			}
+			const Vector &_feedForward(const SparseMatrix &input, Workspace &ws, bool parallel) const {
+				if ((1 != input.Rows()) || (input.Cols() != InSize())) {
+					throw std::runtime_error("Input size mismatch");
+				}
+				ws.sparseSample = input;
+				input.ScatterRow(0, ws.layer[0].Data());
+				return _forwardSample(ws, parallel);
+			}
+			// the first layer reads ws.sparseSample if it has a row, ws.layer[0] otherwise
+			const Vector &_forwardSample(Workspace &ws, bool parallel) const {
+				std::vector<Matrix> &layer = ws.layer;
+				for (size_t i = 1; i < layer.size(); ++i)  {
+					const Matrix &in = layer[i - 1];
+					Matrix &out = layer[i];
+					const Number *b = _masterBias(i);
+					std::copy(b, b + out.Cols(), out.Data());
+					if ((1 == i) && (0 != ws.sparseSample.Rows())) {
+						const SparseMatrix &input = ws.sparseSample;
+						PROFILE_SCOPE(Forward, i, 2*input.NonZeros()*out.Cols(), input.NonZeros()*out.Cols()*sizeof(WeightStorage));
+						LinAlg::Sparse::Gemm<Number, WeightStorage>(input, out.Cols(), _forwardWeight(0), out.Cols(), out.Data(), out.Cols());
+					} else {
+						PROFILE_SCOPE(Forward, i, 2*in.Cols()*out.Cols(), in.Cols()*out.Cols()*sizeof(WeightStorage));
+						_gemm(parallel, 1, out.Cols(), in.Cols(), 1, in.Data(), in.Cols(), 1, _forwardWeight(i - 1), out.Cols(), 1, 1, out.Data(), out.Cols());
+					}
+					_activate(i, out.Data(), out.Rows(), out.Cols(), out.Cols());
+				}
+				std::copy(layer.back().Data(), layer.back().Data() + OutSize(), ws.output.begin());
+				return ws.output;
+			}
+			const Matrix &_predictBatch(ConstMatrixView inputs, Workspace &ws, bool parallel) const {
+				if (inputs.Cols() != InSize()) {
+					throw std::runtime_error("Batch input size mismatch");
+				}
+				ws.ResizeBatch(inputs.Rows());
+				ws.sparseBatch.Gather(inputs.Data(), inputs.Rows(), inputs.Cols(), inputs.RowStride(), inputs.ColStride(), SPARSE_DENSITY);
+				_feedForwardBatch(ws, inputs, parallel);
+				return ws.batchLayer.back();
+			}
+			void _loadBatch(const std::vector<Sample> &samples, size_t begin, size_t end, Workspace &ws) const {
+				ws.ResizeBatch(end - begin);
+				for (size_t r = begin; r < end; ++r) {
+					const Sample &s = samples[r];
+					if ((s.input.size() != InSize()) || (s.output.size() != OutSize())) {
+						throw std::runtime_error("Batch sample size mismatch");
+					}
+					std::copy(s.input.begin(), s.input.end(), ws.batchLayer[0].RowData(r - begin));
+				}
+				const Matrix &inputs = ws.batchLayer[0];
+				ws.sparseBatch.Gather(inputs.Data(), inputs.Rows(), inputs.Cols(), inputs.RowStride(), 1, SPARSE_DENSITY);
+			}
+			void _outputErrors(const std::vector<Sample> &samples, size_t begin, Workspace &ws) const {
+				const Matrix &output = ws.batchLayer.back();
+				Matrix &errors = ws.batchErrors.back();
+				for (size_t r = 0; r < output.Rows(); ++r) {
+					const Vector &answer = samples[begin + r].output;
+					for (size_t c = 0; c < OutSize(); ++c) {
+						errors(r, c) = answer[c] - output(r, c);
+					}
+				}
+			}
+			// input is the B x InSize batch, it is read by the first product in place
+			// unless ws.sparseBatch has its nonzeros
+			void _feedForwardBatch(Workspace &ws, ConstMatrixView input, bool parallel) const {
+				_forwardLayers(ws, input, 0, ws.batchLayer.size() - 1, parallel);
+			}
+			// products of weight layers [first, last), input is layer first
+			void _forwardLayers(Workspace &ws, ConstMatrixView input, size_t first, size_t last, bool parallel) const {
+				for (size_t i = first + 1; i <= last; ++i)  {
+					const ConstMatrixView in = (1 == i) ? input : ws.batchLayer[i - 1].View();
+					Matrix &out = ws.batchLayer[i];
+					const Number *b = _masterBias(i);
+					for (size_t r = 0; r < out.Rows(); ++r) {
+						std::copy(b, b + out.Cols(), out.RowData(r));
+					}
+					if ((1 == i) && (0 != ws.sparseBatch.Rows())) {
+						const SparseMatrix &sparse = ws.sparseBatch;
+						PROFILE_SCOPE(Forward, i, 2*sparse.NonZeros()*out.Cols(), (sparse.NonZeros()*out.Cols()*sizeof(WeightStorage)) + 2*out.Rows()*out.Cols()*sizeof(Number));
+						LinAlg::Sparse::Gemm<Number, WeightStorage>(sparse, out.Cols(), _forwardWeight(0), out.Cols(), out.Data(), out.RowStride(), parallel);
+					} else {
+						PROFILE_SCOPE(Forward, i, 2*in.Rows()*in.Cols()*out.Cols(), (in.Cols()*out.Cols()*sizeof(WeightStorage)) + 2*in.Rows()*(in.Cols() + out.Cols())*sizeof(Number));
+						_gemm(parallel, in.Rows(), out.Cols(), in.Cols(), 1, in.Data(), in.RowStride(), in.ColStride(), _forwardWeight(i - 1), out.Cols(), 1, 1, out.Data(), out.RowStride());
+					}
+					_activate(i, out.Data(), out.Rows(), out.Cols(), out.RowStride());
+				}
+			}
+			// Adds weight and bias gradients to d, averaged over batchSize samples (the whole batch
+			// the rows of ws are a part of), so the step does not depend on the batch size.
+			// Errors of layer k are propagated before the weights of d are updated, so d may be
+			// the network's own parameters.
+			void _backpropagationBatch(Workspace &ws, Parameters &d, size_t batchSize, bool parallel) const {
+				_backwardLayers(ws, d, 0, ws.batchLayer.size() - 1, batchSize, parallel);
+			}
+			// weight layers [first, last) from the last one, errors of layer last are in ws.batchErrors[last]
+			void _backwardLayers(Workspace &ws, Parameters &d, size_t first, size_t last, size_t batchSize, bool parallel) const {
+				const Number rate = Number(learningRate/std::max<size_t>(1, batchSize));
+				std::vector<typename Parameters::View> &dW = d.weight;
+				std::vector<typename Parameters::View> &db = d.bias;
+				const size_t batch = ws.batchLayer[0].Rows();
+				for (int k = int(last) - 1; k >= int(first); k--) {
+					const Matrix &in = ws.batchLayer[k];
+					const Matrix &out = ws.batchLayer[k + 1];
+					Matrix &errors = ws.batchErrors[k + 1];
+					const auto &w = _params.weight[k];
+					if (k > 0) { // error of the previous layer, propagated through weights before update
+						Matrix &errorsNext = ws.batchErrors[k];
+						PROFILE_SCOPE(BackpropError, k + 1, 2*batch*w.Rows()*w.Cols(), (w.Rows()*w.Cols() + batch*(w.Rows() + w.Cols()))*sizeof(Number));
+						_gemm(parallel, batch, w.Rows(), w.Cols(), 1, errors.Data(), errors.RowStride(), 1, w.Data(), 1, w.Cols(), 0, errorsNext.Data(), errorsNext.RowStride());
+					}
+					// errors become gradients in place: e * f'(y) * rate
+					_derivative(k + 1, out.Data(), errors.Data(), errors.Data(), batch, out.Cols(), out.RowStride(), rate);
+					// dW += in^T * gradients
+					if ((0 == k) && (0 != ws.sparseBatch.Rows())) { // only rows of nonzero inputs
+						const SparseMatrix &sparse = ws.sparseBatch;
+						PROFILE_SCOPE(WeightUpdate, k + 1, 2*sparse.NonZeros()*w.Cols(), (2*sparse.NonZeros()*w.Cols() + batch*w.Cols())*sizeof(Number));
+						LinAlg::Sparse::GemmT<Number>(sparse, w.Cols(), errors.Data(), errors.RowStride(), dW[k].Data(), dW[k].Cols(), parallel);
+					} else {
+						PROFILE_SCOPE(WeightUpdate, k + 1, 2*batch*w.Rows()*w.Cols(), (2*w.Rows()*w.Cols() + batch*(w.Rows() + w.Cols()))*sizeof(Number));
+						_gemm(parallel, w.Rows(), w.Cols(), batch, 1, in.Data(), 1, in.RowStride(), errors.Data(), errors.RowStride(), 1, 1, dW[k].Data(), dW[k].Cols());
+					}
+					Number *b = db[k + 1].Data();
+					for (size_t r = 0; r < batch; ++r) {
+						const Number *g = errors.RowData(r);
+						for (size_t c = 0; c < errors.Cols(); ++c) {
+							b[c] += g[c];
 						}
 					}
-				} while (false);
+				}
 			}
-			void _loadTopology(IO::FileReader &f) {
+			// Validates a model file (or one of the original format) and points tensors into it:
+			// biases of every layer, then weights of every layer.
+			static bool _parse(const IO::MappedFile &file, std::vector<size_t> &topology, std::vector<const Number *> &tensors) {
+				bool res = false;
 				do {
-					uint32_t v;
-					std::vector<size_t> topo;
-					if (!f.Read<uint32_t>(v)) {
-						break;
-					}
-					topo.resize(v);
-					for (auto &ls: topo) {
-						if (!f.Read<uint32_t>(v)) {
+					const uint8_t *data = file.Data();
+					const size_t size = file.Size();
+					topology.clear();
+					tensors.clear();
+					if ((size >= sizeof(ModelHeader)) && (0 == std::memcmp(data, MODEL_MAGIC, sizeof(MODEL_MAGIC)))) {
+						ModelHeader header;
+						std::memcpy(&header, data, sizeof(header));
+						if ((MODEL_VERSION != header.version) || (MODEL_ENDIAN != header.endian) || (sizeof(Number) != header.numberSize) || (header.layers < 2) || (header.size != size)) {
 							break;
 						}
-						ls = v;
+						if ((header.topologyOffset != ModelLayout::AlignUp(sizeof(header))) || (header.topologyOffset + uint64_t(header.layers)*sizeof(uint64_t) > size)) {
+							break;
+						}
+						topology.resize(header.layers);
+						for (size_t i = 0; i < topology.size(); ++i) {
+							uint64_t v;
+							std::memcpy(&v, data + header.topologyOffset + i*sizeof(v), sizeof(v));
+							topology[i] = v;
+						}
+						ModelLayout layout;
+						if (!layout.Build(topology, sizeof(Number)) || (layout.size != size)) {
+							break;
+						}
+						uint64_t checksum = IO::Checksum(data + header.topologyOffset, topology.size()*sizeof(uint64_t));
+						for (size_t t = 0; t < layout.offset.size(); ++t) {
+							checksum = IO::Checksum(data + layout.offset[t], layout.bytes[t], checksum);
+							tensors.push_back(reinterpret_cast<const Number *>(data + layout.offset[t]));
+						}
+						res = (checksum == header.checksum);
+					} else { // original format
+						uint32_t v = 0;
+						if (size >= sizeof(v)) {
+							std::memcpy(&v, data, sizeof(v));
+						}
+						if ((v < 2) || (size < (uint64_t(v) + 1)*sizeof(v))) {
+							break;
+						}
+						topology.resize(v);
+						uint64_t numbers = 0;
+						for (size_t i = 0; i < topology.size(); ++i) {
+							std::memcpy(&v, data + (i + 1)*sizeof(v), sizeof(v));
+							topology[i] = v;
+							numbers += v;
+							if (i > 0) {
+								numbers += uint64_t(topology[i - 1])*v;
+							}
+						}
+						uint64_t pos = (topology.size() + 1)*sizeof(v);
+						if ((size - pos != numbers*sizeof(Number)) || (numbers > (size - pos)/sizeof(Number))) {
+							break;
+						}
+						for (size_t i = 0; i < topology.size(); ++i) {
+							tensors.push_back(reinterpret_cast<const Number *>(data + pos));
+							pos += topology[i]*sizeof(Number);
+						}
+						for (size_t i = 0; i + 1 < topology.size(); ++i) {
+							tensors.push_back(reinterpret_cast<const Number *>(data + pos));
+							pos += topology[i]*topology[i + 1]*sizeof(Number);
+						}
+						res = true;
 					}
-					BuildTopology(topo);
 				} while (false);
+				return res;
 			}
-			std::vector<Matrix> _layer;
-			std::vector<Matrix> _bias;
-			std::vector<Matrix> _weight;
+			std::vector<size_t> _topology;
+			Parameters _params;
+			bool _hugePages = false;
+			std::vector<StorageMatrix> _storedWeight; // compact copy of weights, only with COMPACT_WEIGHTS
+			std::shared_ptr<IO::MappedFile> _mapping; // model file the tensors are used from
+			std::vector<const Number *> _mappedBias;
+			std::vector<const Number *> _mappedWeight;
+			Workspace _ws;
 
 			double learningRate;
-			UnaryInplaceFunction activation;
-			UnaryFunction derivative;
 	};
 }
 
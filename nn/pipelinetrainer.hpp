@@ -0,0 +1,285 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef NN_PIPELINETRAINER_HPP
+#define NN_PIPELINETRAINER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace NN {
+	/*
+		Pipeline-parallel mini-batch training of a TPerceptron. Weight layers are split into
+		contiguous stages of about equal work, every stage is a persistent thread (the calling
+		thread is stage 0) that owns the weights and biases of its layers. A batch is cut into
+		micro-batches which stream through the stages: forward passes go from the first stage
+		to the last one, backward passes back, and every stage alternates them (1F1B schedule):
+		stage s runs stages - s - 1 forward passes ahead, then one forward and one backward pass
+		in turn, so at most stages micro-batches are in flight, each in its own workspace.
+		Flush mode sums gradients of all micro-batches and applies them at the end of the batch,
+		so it is one update per batch as TPerceptron::TrainBatch. Async mode applies gradients
+		of every micro-batch right after its backward pass: later micro-batches see the update,
+		and a backward pass runs on weights at most stages - 1 updates newer than its forward
+		pass did. Every stage changes only its own layers in a fixed order, so in both modes the
+		result does not depend on thread timing.
+		Products of a stage are small, they run serially on the stage's thread.
+	*/
+	template <class PERCEPTRON> class TPipelineTrainer {
+		public:
+			using Perceptron = PERCEPTRON;
+			using Matrix = typename Perceptron::Matrix;
+			using Sample = typename Perceptron::Sample;
+			using Workspace = typename Perceptron::Workspace;
+			using Gradients = typename Perceptron::Gradients;
+			enum class Mode {
+				Flush,
+				Async
+			};
+
+			TPipelineTrainer(Perceptron &net, size_t stages, size_t microBatch, size_t batchCapacity, Mode mode=Mode::Flush)
+				: _net(net)
+				, _mode(mode)
+				, _microBatch(std::max<size_t>(1, microBatch))
+				, _bounds(Partition(net.Topology(), stages))
+				, _progress(_bounds.size() - 1)
+				, _grads(_progress.size())
+				, _samples(nullptr)
+				, _microBatches(0)
+				, _generation(0)
+				, _pending(0)
+				, _stopping(false)
+				, _sleepers(0) {
+				_net.Materialize(); // stages update the network's own tensors
+				_slots.resize(Stages());
+				for (size_t i = 0; i < Stages(); ++i) {
+					_slots[i].Resize(_net.Topology(), _microBatch);
+					_grads[i].Resize(_net.Topology(), _bounds[i], _bounds[i + 1], _net.HugePages());
+				}
+				_output.Resize(batchCapacity, _net.OutSize());
+				for (size_t i = 1; i < Stages(); ++i) {
+					_threads.emplace_back(&TPipelineTrainer::_loop, this, i);
+				}
+			}
+			~TPipelineTrainer() {
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_stopping = true;
+					_startCV.notify_all();
+				}
+				for (std::thread &t: _threads) {
+					t.join();
+				}
+			}
+			TPipelineTrainer(const TPipelineTrainer &) = delete;
+			TPipelineTrainer &operator = (const TPipelineTrainer &) = delete;
+
+			// Splits weight layers of the topology into at most stages contiguous ranges with
+			// the least work (weights count) of the largest one. Stage s owns weight layers
+			// [res[s], res[s + 1]).
+			static std::vector<size_t> Partition(const std::vector<size_t> &topology, size_t stages) {
+				const size_t layers = (topology.size() > 1) ? topology.size() - 1 : 0;
+				if (0 == layers) {
+					throw std::runtime_error("Network has no layers");
+				}
+				stages = std::min(std::max<size_t>(1, stages), layers);
+				std::vector<double> prefix(layers + 1, 0.);
+				for (size_t k = 0; k < layers; ++k) {
+					prefix[k + 1] = prefix[k] + double(topology[k])*topology[k + 1];
+				}
+				// cost[s][k] - the largest stage of the best split of layers [0, k) into s stages
+				std::vector<std::vector<double>> cost(stages + 1, std::vector<double>(layers + 1, 1e300));
+				std::vector<std::vector<size_t>> cut(stages + 1, std::vector<size_t>(layers + 1, 0));
+				cost[0][0] = 0.;
+				for (size_t s = 1; s <= stages; ++s) {
+					for (size_t k = s; k <= layers; ++k) {
+						for (size_t j = s - 1; j < k; ++j) {
+							const double c = std::max(cost[s - 1][j], prefix[k] - prefix[j]);
+							if (c < cost[s][k]) {
+								cost[s][k] = c;
+								cut[s][k] = j;
+							}
+						}
+					}
+				}
+				std::vector<size_t> res(stages + 1, layers);
+				for (size_t s = stages; s > 0; --s) {
+					res[s - 1] = cut[s][res[s]];
+				}
+				return res;
+			}
+
+			size_t Stages() const {
+				return _bounds.size() - 1;
+			}
+			// weight layers of stage s are [Bounds()[s], Bounds()[s + 1])
+			const std::vector<size_t> &Bounds() const {
+				return _bounds;
+			}
+			// Same contract as TPerceptron::TrainBatch, returns B x OutSize outputs of the forward
+			// passes (in Async mode later micro-batches are computed after earlier updates).
+			const Matrix &TrainBatch(const std::vector<Sample> &samples) {
+				for (const Sample &s: samples) { // stages must not fail halfway
+					if ((s.input.size() != _net.InSize()) || (s.output.size() != _net.OutSize())) {
+						throw std::runtime_error("Batch sample size mismatch");
+					}
+				}
+				_samples = &samples;
+				_microBatches = (samples.size() + _microBatch - 1)/_microBatch;
+				_output.Resize(samples.size(), _net.OutSize());
+				for (Progress &p: _progress) {
+					p.forward.store(0, std::memory_order_relaxed);
+					p.backward.store(0, std::memory_order_relaxed);
+				}
+				_run();
+				_samples = nullptr;
+				return _output;
+			}
+
+		private:
+			static constexpr size_t SPIN = 1 << 10; // yields of a waiting stage before it sleeps
+
+			// micro-batches a stage has passed forward and backward in the current batch
+			struct alignas(64) Progress {
+				std::atomic<size_t> forward{0};
+				std::atomic<size_t> backward{0};
+			};
+
+			// the 1F1B schedule of stage s
+			void _stage(size_t s) {
+				const size_t stages = Stages();
+				const size_t first = _bounds[s];
+				const size_t last = _bounds[s + 1];
+				const size_t count = _microBatches;
+				Gradients &grads = _grads[s];
+				grads.Zero();
+				size_t f = 0;
+				size_t b = 0;
+				const size_t warmup = std::min(stages - s - 1, count);
+				while (f < warmup) {
+					_forward(s, f++, first, last);
+				}
+				while (b < count) {
+					if (f < count) {
+						_forward(s, f++, first, last);
+					}
+					if (s + 1 < stages) {
+						_wait(_progress[s + 1].backward, b);
+					}
+					Workspace &ws = _slots[b % stages];
+					// a flush averages over the batch, an async update over its micro-batch
+					_net.BackwardLayers(first, last, ws, grads, (Mode::Flush == _mode) ? _samples->size() : ws.batchLayer[0].Rows());
+					if (Mode::Async == _mode) {
+						_net.ApplyLayerGradients(grads, first, last);
+						grads.Zero();
+					}
+					_advance(_progress[s].backward, ++b);
+				}
+				if ((Mode::Flush == _mode) && (count > 0)) {
+					_net.ApplyLayerGradients(grads, first, last);
+				}
+			}
+			void _forward(size_t s, size_t m, size_t first, size_t last) {
+				if (s > 0) {
+					_wait(_progress[s - 1].forward, m);
+				}
+				Workspace &ws = _slots[m % Stages()];
+				const size_t begin = m*_microBatch;
+				const size_t end = std::min(_samples->size(), begin + _microBatch);
+				_net.ForwardLayers(*_samples, begin, end, first, last, ws);
+				if (s + 1 == Stages()) {
+					const Matrix &out = ws.batchLayer.back();
+					for (size_t r = 0; r < out.Rows(); ++r) {
+						std::copy(out.RowData(r), out.RowData(r) + out.Cols(), _output.RowData(begin + r));
+					}
+				}
+				_advance(_progress[s].forward, m + 1);
+			}
+			// Waits until counter passes index. A neighbour stage is usually about one pass away,
+			// so the wait yields for a while and then sleeps until _advance() wakes it up: stages
+			// of an unbalanced split or on an oversubscribed machine don't burn their cores.
+			void _wait(const std::atomic<size_t> &counter, size_t index) {
+				for (size_t i = 0; i < SPIN; ++i) {
+					if (counter.load(std::memory_order_acquire) > index) {
+						return;
+					}
+					std::this_thread::yield();
+				}
+				std::unique_lock<std::mutex> lock(_progressMutex);
+				_sleepers.fetch_add(1); // seq_cst with the load in _advance: one of them sees the other
+				_progressCV.wait(lock, [&counter, index]() {
+					return counter.load() > index;
+				});
+				_sleepers.fetch_sub(1, std::memory_order_relaxed);
+			}
+			// publishes progress of a stage and wakes up sleeping neighbours
+			void _advance(std::atomic<size_t> &counter, size_t value) {
+				counter.store(value);
+				if (0 != _sleepers.load()) {
+					std::unique_lock<std::mutex> lock(_progressMutex);
+					_progressCV.notify_all();
+				}
+			}
+			// runs the schedule of every stage and waits for all of them
+			void _run() {
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_pending = Stages() - 1;
+					_generation++;
+					_startCV.notify_all();
+				}
+				_stage(0);
+				std::unique_lock<std::mutex> lock(_mutex);
+				_doneCV.wait(lock, [this]() {
+					return 0 == _pending;
+				});
+			}
+			void _loop(size_t s) {
+				size_t seen = 0;
+				while (true) {
+					{
+						std::unique_lock<std::mutex> lock(_mutex);
+						_startCV.wait(lock, [this, seen]() {
+							return _stopping || (_generation != seen);
+						});
+						if (_stopping) {
+							break;
+						}
+						seen = _generation;
+					}
+					_stage(s);
+					std::unique_lock<std::mutex> lock(_mutex);
+					if (0 == --_pending) {
+						_doneCV.notify_one();
+					}
+				}
+			}
+
+			Perceptron &_net;
+			Mode _mode;
+			size_t _microBatch;
+			std::vector<size_t> _bounds;
+			std::vector<Progress> _progress;
+			std::vector<Gradients> _grads; // of the stage's layers only, one set per stage
+			std::vector<Workspace> _slots; // micro-batch m lives in _slots[m % Stages()]
+			Matrix _output;
+			const std::vector<Sample> *_samples;
+			size_t _microBatches;
+			size_t _generation;
+			size_t _pending;
+			bool _stopping;
+			std::mutex _mutex;
+			std::condition_variable _startCV;
+			std::condition_variable _doneCV;
+			std::atomic<size_t> _sleepers; // stages sleeping in _wait()
+			std::mutex _progressMutex;
+			std::condition_variable _progressCV;
+			std::vector<std::thread> _threads;
+	};
+}
+
+#endif
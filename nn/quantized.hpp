@@ -0,0 +1,217 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef NN_QUANTIZED_HPP
+#define NN_QUANTIZED_HPP
+
+#include "linalg/qgemm.hpp"
+#include "linalg/simd.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace NN {
+	/*
+		Post-training int8 quantization of a trained TPerceptron for inference.
+		Weights are quantized symmetrically with a scale per output neuron (column of W).
+		Inputs of every layer are quantized to uint8 with a scale and a zero point taken
+		from the range seen on a calibration set:
+			x = inScale*(q - inZero), w[k][j] = scale[j]*wq[k][j]
+			y[j] = inScale*scale[j]*(sum_k q[k]*wq[k][j] - inZero*sum_k wq[k][j]) + bias[j]
+		Products are accumulated in int32 by LinAlg::QGemm, activations are computed in
+		float by the network's own policies and quantized again for the next layer.
+		The quantized network is immutable, all scratch state lives in a Workspace.
+	*/
+	template <class PERCEPTRON> class TQuantizedPerceptron {
+		public:
+			using Perceptron = PERCEPTRON;
+			using Number = typename Perceptron::Number;
+			using Vector = typename Perceptron::Vector;
+			using Matrix = typename Perceptron::Matrix;
+			using Sample = typename Perceptron::Sample;
+
+			struct Workspace {
+				std::vector<uint8_t> input; // quantized input of a layer, rows padded to PaddedK
+				std::vector<int32_t> acc;
+				Matrix values; // float outputs of a layer
+				Vector output;
+			};
+
+			// Builds the quantized copy of net, activation ranges are measured on calibration
+			// inputs (all of them are run through the float network once).
+			bool Quantize(const Perceptron &net, const std::vector<Sample> &calibration) {
+				bool res = false;
+				do {
+					const std::vector<size_t> &topology = net.Topology();
+					if ((topology.size() < 2) || calibration.empty()) {
+						break;
+					}
+					std::vector<Number> low(topology.size(), Number(0));
+					std::vector<Number> high(topology.size(), Number(0));
+					typename Perceptron::Workspace ws;
+					for (const Sample &sample: calibration) {
+						net.Predict(sample.input, ws);
+						for (size_t l = 0; l + 1 < topology.size(); ++l) {
+							const Number *a = ws.layer[l].Data();
+							for (size_t i = 0; i < topology[l]; ++i) {
+								low[l] = std::min(low[l], a[i]);
+								high[l] = std::max(high[l], a[i]);
+							}
+						}
+					}
+					_topology = topology;
+					_layers.resize(topology.size() - 1);
+					for (size_t l = 0; l < _layers.size(); ++l) {
+						_quantizeLayer(_layers[l], net.Weights()[l], net.Biases()[l + 1], low[l], high[l]);
+					}
+					res = true;
+				} while (false);
+				return res;
+			}
+
+			const Vector &Predict(const Vector &input, Workspace &ws) const {
+				if (input.size() != InSize()) {
+					throw std::runtime_error("Input size mismatch");
+				}
+				_prepare(ws, 1);
+				_quantizeInput(_layers[0], input.data(), 1, InSize(), 1, ws);
+				_forward(1, ws);
+				ws.output.assign(ws.values.Data(), ws.values.Data() + OutSize());
+				return ws.output;
+			}
+			// one sample per row of inputs (of any strides, e.g. an ALIGNED matrix), returns
+			// B x OutSize matrix of outputs
+			const Matrix &PredictBatch(typename Perceptron::ConstMatrixView inputs, Workspace &ws) const {
+				if (inputs.Cols() != InSize()) {
+					throw std::runtime_error("Batch input size mismatch");
+				}
+				_prepare(ws, inputs.Rows());
+				_quantizeInput(_layers[0], inputs.Data(), inputs.Rows(), inputs.RowStride(), inputs.ColStride(), ws);
+				_forward(inputs.Rows(), ws);
+				return ws.values;
+			}
+
+			size_t InSize() const {
+				return _topology.empty() ? 0 : _topology.front();
+			}
+			size_t OutSize() const {
+				return _topology.empty() ? 0 : _topology.back();
+			}
+			// memory taken by quantized weights
+			size_t WeightBytes() const {
+				size_t res = 0;
+				for (const Layer &layer: _layers) {
+					res += layer.weight.size();
+				}
+				return res;
+			}
+
+		private:
+			struct Layer {
+				size_t in;
+				size_t out;
+				std::vector<int8_t> weight; // packed for QGemm
+				std::vector<float> scale; // inScale*weight scale per output
+				std::vector<int32_t> correction; // inZero*sum of quantized weights per output
+				std::vector<float> bias;
+				float inScale;
+				int32_t inZero;
+			};
+
+			static void _quantizeLayer(Layer &layer, typename Perceptron::ConstMatrixView w, typename Perceptron::ConstMatrixView b, Number low, Number high) {
+				layer.in = w.Rows();
+				layer.out = w.Cols();
+				// the range contains zero, so zero is represented exactly
+				layer.inScale = (high > low) ? float(high - low)/255.f : 1.f;
+				layer.inZero = std::lround(-low/layer.inScale);
+				std::vector<int8_t> q(layer.in*layer.out);
+				layer.scale.resize(layer.out);
+				layer.correction.resize(layer.out);
+				layer.bias.assign(b.Data(), b.Data() + layer.out);
+				for (size_t j = 0; j < layer.out; ++j) {
+					Number top = 0;
+					for (size_t k = 0; k < layer.in; ++k) {
+						top = std::max(top, std::fabs(w.Data()[k*layer.out + j]));
+					}
+					const float scale = (top > 0) ? float(top)/127.f : 1.f;
+					int32_t sum = 0;
+					for (size_t k = 0; k < layer.in; ++k) {
+						const long v = std::lround(w.Data()[k*layer.out + j]/scale);
+						q[k*layer.out + j] = int8_t(std::max(-127l, std::min(127l, v)));
+						sum += q[k*layer.out + j];
+					}
+					layer.scale[j] = layer.inScale*scale;
+					layer.correction[j] = layer.inZero*sum;
+				}
+				layer.weight.resize(LinAlg::QGemm::PackedSize(layer.in, layer.out));
+				LinAlg::QGemm::PackB(layer.in, layer.out, q.data(), layer.out, layer.weight.data());
+			}
+			void _prepare(Workspace &ws, size_t rows) const {
+				size_t input = 0;
+				size_t acc = 0;
+				for (const Layer &layer: _layers) {
+					input = std::max(input, LinAlg::QGemm::PaddedK(layer.in));
+					acc = std::max(acc, layer.out);
+				}
+				if (ws.input.size() < rows*input) {
+					ws.input.resize(rows*input, 0);
+				}
+				if (ws.acc.size() < rows*acc) {
+					ws.acc.resize(rows*acc);
+				}
+			}
+			// float rows (layer.in wide, x[r*rs + i*cs]) to uint8 rows (PaddedK wide) of ws.input
+			static void _quantizeInput(const Layer &layer, const Number *x, size_t rows, size_t rs, size_t cs, Workspace &ws) {
+				const size_t lda = LinAlg::QGemm::PaddedK(layer.in);
+				const float inv = 1.f/layer.inScale;
+				const float zero = layer.inZero;
+				for (size_t r = 0; r < rows; ++r) {
+					const Number *xr = x + r*rs;
+					uint8_t *q = ws.input.data() + r*lda;
+					if (1 == cs) {
+						LINALG_PRAGMA_SIMD
+						for (size_t i = 0; i < layer.in; ++i) {
+							q[i] = _quantize(xr[i], inv, zero);
+						}
+					} else {
+						for (size_t i = 0; i < layer.in; ++i) {
+							q[i] = _quantize(xr[i*cs], inv, zero);
+						}
+					}
+				}
+			}
+			static uint8_t _quantize(Number x, float inv, float zero) {
+				float v = std::nearbyint(x*inv) + zero;
+				v = (v < 0.f) ? 0.f : v;
+				v = (v > 255.f) ? 255.f : v;
+				return uint8_t(v);
+			}
+			void _forward(size_t rows, Workspace &ws) const {
+				for (size_t l = 0; l < _layers.size(); ++l) {
+					const Layer &layer = _layers[l];
+					const size_t lda = LinAlg::QGemm::PaddedK(layer.in);
+					LinAlg::QGemm::Gemm(rows, layer.out, layer.in, ws.input.data(), lda, layer.weight.data(), ws.acc.data(), layer.out);
+					ws.values.Resize(rows, layer.out);
+					for (size_t r = 0; r < rows; ++r) {
+						const int32_t *acc = ws.acc.data() + r*layer.out;
+						Number *y = ws.values.Data() + r*layer.out;
+						LINALG_PRAGMA_SIMD
+						for (size_t j = 0; j < layer.out; ++j) {
+							y[j] = Number(layer.scale[j]*float(acc[j] - layer.correction[j]) + layer.bias[j]);
+						}
+					}
+					if (l + 1 == _layers.size()) {
+						Perceptron::OutputActivation::Forward(ws.values.Data(), rows, layer.out, layer.out);
+					} else {
+						Perceptron::HiddenActivation::Forward(ws.values.Data(), rows, layer.out, layer.out);
+						_quantizeInput(_layers[l + 1], ws.values.Data(), rows, layer.out, 1, ws);
+					}
+				}
+			}
+
+			std::vector<size_t> _topology;
+			std::vector<Layer> _layers;
+	};
+}
+
+#endif
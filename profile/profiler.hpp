@@ -0,0 +1,242 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+#ifndef PROFILE_PROFILER_HPP
+#define PROFILE_PROFILER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+/*
+	Hot-path profiler: scoped timers with call, FLOP and byte counters per phase and layer.
+	It is compiled in by defining PROFILE_ENABLED (CMake option PERCEPTRON_PROFILE), otherwise
+	PROFILE_SCOPE expands to nothing and its arguments are not evaluated.
+	Every thread adds to its own block of counters (single writer, no locked instructions),
+	Snapshot() sums the blocks of all threads. Kernel phases (Gemm, Gemv) nest inside the
+	network ones, so their times overlap.
+*/
+#ifdef PROFILE_ENABLED
+	#define PROFILE_CONCAT_(a, b) a##b
+	#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+	#define PROFILE_SCOPE(phase, layer, flops, bytes) Profile::ScopedTimer PROFILE_CONCAT(_profileScope, __LINE__)(Profile::Phase::phase, layer, flops, bytes)
+#else
+	#define PROFILE_SCOPE(phase, layer, flops, bytes)
+#endif
+
+namespace Profile {
+	enum class Phase : uint8_t {
+		Gemm, // matrix-matrix kernel
+		Gemv, // row vector by matrix kernel
+		Sparse, // sparse by dense matrix kernels
+		Forward, // products of a forward pass
+		Activation,
+		Derivative, // gradients of activations
+		BackpropError, // error propagated to the previous layer
+		WeightUpdate, // weight and bias gradients or updates
+		FusedBackward, // per-sample error propagation and update in one sweep
+		Parse,
+		Count
+	};
+	inline const char *PhaseName(Phase phase) {
+		static const char *NAMES[] = {"gemm", "gemv", "sparse", "forward", "activation", "derivative", "backprop_error", "weight_update", "fused_backward", "parse"};
+		return (phase < Phase::Count) ? NAMES[size_t(phase)] : "?";
+	}
+
+	static constexpr size_t MAX_LAYERS = 32; // deeper layers are added to the last slot
+
+	struct Counter {
+		uint64_t calls;
+		uint64_t nanoseconds;
+		uint64_t flops;
+		uint64_t bytes;
+	};
+	struct Entry {
+		Phase phase;
+		int layer; // layer whose outputs are computed (weights from layer-1), -1 outside of a network
+		Counter counter;
+	};
+
+	class Profiler {
+		public:
+			static Profiler &Instance() {
+				static Profiler profiler;
+				return profiler;
+			}
+			~Profiler() {
+				StopReporting();
+			}
+			Profiler(const Profiler &) = delete;
+			Profiler &operator = (const Profiler &) = delete;
+
+			void Add(Phase phase, int layer, uint64_t nanoseconds, uint64_t flops, uint64_t bytes) {
+				if (_ignored()) {
+					return;
+				}
+				Slot &slot = _local().slot[size_t(phase)][_index(layer)];
+				_add(slot.calls, 1);
+				_add(slot.nanoseconds, nanoseconds);
+				_add(slot.flops, flops);
+				_add(slot.bytes, bytes);
+			}
+			// work of the calling thread is not counted any more (e.g. of the autotuner's benchmarks)
+			static void IgnoreThisThread() {
+				_ignored() = true;
+			}
+			// non-zero counters summed over threads, by phase and then layer
+			std::vector<Entry> Snapshot() {
+				std::vector<Entry> res;
+				std::unique_lock<std::mutex> lock(_mutex);
+				for (size_t p = 0; p < size_t(Phase::Count); ++p) {
+					for (size_t l = 0; l <= MAX_LAYERS; ++l) {
+						Counter sum = {0, 0, 0, 0};
+						for (const std::unique_ptr<Block> &block: _blocks) {
+							const Slot &slot = block->slot[p][l];
+							sum.calls += slot.calls.load(std::memory_order_relaxed);
+							sum.nanoseconds += slot.nanoseconds.load(std::memory_order_relaxed);
+							sum.flops += slot.flops.load(std::memory_order_relaxed);
+							sum.bytes += slot.bytes.load(std::memory_order_relaxed);
+						}
+						if (sum.calls > 0) {
+							res.push_back({Phase(p), int(l) - 1, sum});
+						}
+					}
+				}
+				return res;
+			}
+			// counters of threads working right now may be cleared a little late
+			void Reset() {
+				std::unique_lock<std::mutex> lock(_mutex);
+				for (std::unique_ptr<Block> &block: _blocks) {
+					for (auto &phase: block->slot) {
+						for (Slot &slot: phase) {
+							slot.calls.store(0, std::memory_order_relaxed);
+							slot.nanoseconds.store(0, std::memory_order_relaxed);
+							slot.flops.store(0, std::memory_order_relaxed);
+							slot.bytes.store(0, std::memory_order_relaxed);
+						}
+					}
+				}
+			}
+			// table of counters with achieved GFLOP/s and GB/s, and the share of peak if it is known
+			void Report(std::ostream &os, double peakGflops = 0) {
+				const std::vector<Entry> entries = Snapshot();
+				os << std::left << std::setw(16) << "phase" << std::right << std::setw(6) << "layer" << std::setw(12) << "calls" << std::setw(12) << "ms" << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s";
+				os << ((peakGflops > 0) ? "    peak" : "") << std::endl;
+				for (const Entry &e: entries) {
+					const double seconds = e.counter.nanoseconds*1e-9;
+					const double gflops = (seconds > 0) ? e.counter.flops*1e-9/seconds : 0;
+					os << std::left << std::setw(16) << PhaseName(e.phase) << std::right << std::setw(6);
+					if (e.layer < 0) {
+						os << "-";
+					} else {
+						os << e.layer;
+					}
+					os << std::setw(12) << e.counter.calls << std::fixed << std::setprecision(2) << std::setw(12) << seconds*1e3 << std::setw(10) << gflops << std::setw(10) << ((seconds > 0) ? e.counter.bytes*1e-9/seconds : 0);
+					if (peakGflops > 0) {
+						os << std::setw(7) << gflops*100/peakGflops << "%";
+					}
+					os.unsetf(std::ios::floatfield);
+					os << std::endl;
+				}
+			}
+			// prints Report() every period from a background thread until StopReporting()
+			void StartReporting(std::chrono::milliseconds period, std::ostream &os, double peakGflops = 0) {
+				StopReporting();
+				std::unique_lock<std::mutex> lock(_reportMutex);
+				_reporting = true;
+				_reporter = std::thread([this, period, &os, peakGflops]() {
+					std::unique_lock<std::mutex> lock(_reportMutex);
+					while (!_reportCV.wait_for(lock, period, [this]() { return !_reporting; })) {
+						Report(os, peakGflops);
+					}
+				});
+			}
+			void StopReporting() {
+				{
+					std::unique_lock<std::mutex> lock(_reportMutex);
+					_reporting = false;
+					_reportCV.notify_all();
+				}
+				if (_reporter.joinable()) {
+					_reporter.join();
+				}
+			}
+
+		private:
+			struct Slot {
+				std::atomic<uint64_t> calls{0};
+				std::atomic<uint64_t> nanoseconds{0};
+				std::atomic<uint64_t> flops{0};
+				std::atomic<uint64_t> bytes{0};
+			};
+			// counters of one thread, they outlive the thread
+			struct Block {
+				Slot slot[size_t(Phase::Count)][MAX_LAYERS + 1];
+			};
+
+			Profiler()
+				: _reporting(false) {
+			}
+			static size_t _index(int layer) {
+				return (layer < 0) ? 0 : std::min<size_t>(layer, MAX_LAYERS - 1) + 1;
+			}
+			static bool &_ignored() {
+				thread_local bool ignored = false;
+				return ignored;
+			}
+			// only the owning thread writes, so a plain load and store is enough
+			static void _add(std::atomic<uint64_t> &counter, uint64_t value) {
+				counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+			}
+			Block &_local() {
+				thread_local Block *block = nullptr;
+				if (nullptr == block) {
+					std::unique_lock<std::mutex> lock(_mutex);
+					_blocks.emplace_back(new Block());
+					block = _blocks.back().get();
+				}
+				return *block;
+			}
+
+			std::mutex _mutex;
+			std::vector<std::unique_ptr<Block>> _blocks;
+			std::mutex _reportMutex;
+			std::condition_variable _reportCV;
+			bool _reporting;
+			std::thread _reporter;
+	};
+
+	class ScopedTimer {
+		public:
+			ScopedTimer(Phase phase, int layer, uint64_t flops, uint64_t bytes)
+				: _phase(phase)
+				, _layer(layer)
+				, _flops(flops)
+				, _bytes(bytes)
+				, _start(std::chrono::steady_clock::now()) {
+			}
+			~ScopedTimer() {
+				const auto elapsed = std::chrono::steady_clock::now() - _start;
+				Profiler::Instance().Add(_phase, _layer, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), _flops, _bytes);
+			}
+			ScopedTimer(const ScopedTimer &) = delete;
+			ScopedTimer &operator = (const ScopedTimer &) = delete;
+		private:
+			Phase _phase;
+			int _layer;
+			uint64_t _flops;
+			uint64_t _bytes;
+			std::chrono::steady_clock::time_point _start;
+	};
+}
+
+#endif
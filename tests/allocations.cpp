@@ -0,0 +1,114 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+// Steady-state training and inference of TPerceptron must not allocate: after a warm-up
+// pass every buffer lives in the network's workspace and parameters.
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "nn/perceptron.hpp"
+
+namespace {
+	std::atomic<size_t> allocations(0);
+}
+
+// Every replaced operator goes through this pair, so the compiler sees malloc/free
+// matched with each other rather than free called on what operator new returned.
+static void *_acquire(size_t size, size_t align) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	size = size ? size : 1;
+	void *p = (align > alignof(std::max_align_t)) ? std::aligned_alloc(align, (size + align - 1)/align*align) : std::malloc(size);
+	if (nullptr == p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+static void _release(void *p) {
+	std::free(p);
+}
+
+void *operator new(size_t size) {
+	return _acquire(size, 0);
+}
+void *operator new[](size_t size) {
+	return _acquire(size, 0);
+}
+// linalg storage is aligned (linalg/allocator.hpp, linalg/arena.hpp)
+void *operator new(size_t size, std::align_val_t align) {
+	return _acquire(size, static_cast<size_t>(align));
+}
+void *operator new[](size_t size, std::align_val_t align) {
+	return _acquire(size, static_cast<size_t>(align));
+}
+void operator delete(void *p) noexcept {
+	_release(p);
+}
+void operator delete[](void *p) noexcept {
+	_release(p);
+}
+void operator delete(void *p, size_t) noexcept {
+	_release(p);
+}
+void operator delete[](void *p, size_t) noexcept {
+	_release(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept {
+	_release(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept {
+	_release(p);
+}
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+	_release(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+	_release(p);
+}
+
+namespace {
+	using Perceptron = NN::TPerceptron<float, NN::Activation::Sigmoid>;
+
+	// allocations made by f on its second run, the first one warms buffers up
+	template <class FUNCTION> size_t SteadyAllocations(FUNCTION &&f) {
+		f();
+		const size_t before = allocations.load(std::memory_order_relaxed);
+		f();
+		return allocations.load(std::memory_order_relaxed) - before;
+	}
+	bool Check(const char *name, size_t count) {
+		std::printf("%-16s %zu allocations\n", name, count);
+		return 0 == count;
+	}
+}
+
+int main() {
+	const size_t BATCH = 32;
+	const std::vector<size_t> topology = {64, 48, 10};
+	Perceptron net(0.05);
+	net.BuildTopology(topology, BATCH);
+	net.Init(1);
+	std::vector<Perceptron::Sample> samples(BATCH, Perceptron::Sample(topology.front(), topology.back()));
+	for (size_t i = 0; i < samples.size(); ++i) {
+		for (size_t j = 0; j < samples[i].input.size(); ++j) {
+			samples[i].input[j] = float((i*7 + j*3) % 11)/11.f;
+		}
+		samples[i].output[i % topology.back()] = 1.f;
+	}
+
+	LinAlg::ThreadPool pool(4); // parallel paths run even on one CPU
+	LinAlg::ThreadPool::Scope scope(pool);
+	bool res = true;
+	res &= Check("feedForward", SteadyAllocations([&]() {
+		net.feedForward(samples[0].input);
+	}));
+	res &= Check("backpropagation", SteadyAllocations([&]() {
+		net.feedForward(samples[1].input);
+		net.backpropagation(samples[1].output);
+	}));
+	res &= Check("TrainBatch", SteadyAllocations([&]() {
+		net.TrainBatch(samples);
+	}));
+	return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,62 @@
+/*
+	Copyright (c) 2023 Tikhon Kozyrev (tikhon.kozyrev@gmail.com)
+*/
+// TQuantizedPerceptron::PredictBatch must read inputs by their strides: the same samples
+// stored densely, with rows padded to cache lines (Matrix::ALIGNED) and one by one give the
+// same outputs.
+#include <cstdio>
+#include <cstdlib>
+#include "nn/perceptron.hpp"
+#include "nn/quantized.hpp"
+
+namespace {
+	using Perceptron = NN::TPerceptron<float, NN::Activation::Sigmoid>;
+	using QuantizedPerceptron = NN::TQuantizedPerceptron<Perceptron>;
+
+	float MaxDifference(const Perceptron::Matrix &a, const Perceptron::Matrix &b) {
+		float res = (a.Rows() == b.Rows()) && (a.Cols() == b.Cols()) ? 0.f : 1e30f;
+		for (size_t r = 0; (r < a.Rows()) && (r < b.Rows()); ++r) {
+			for (size_t c = 0; (c < a.Cols()) && (c < b.Cols()); ++c) {
+				res = std::max(res, std::fabs(a.at(r, c) - b.at(r, c)));
+			}
+		}
+		return res;
+	}
+}
+
+int main() {
+	const size_t ROWS = 3;
+	const std::vector<size_t> topology = {37, 20, 10}; // rows of 37 floats are padded to 48
+	Perceptron net(0.05);
+	net.BuildTopology(topology);
+	net.Init(1);
+	std::vector<Perceptron::Sample> samples(ROWS, Perceptron::Sample(topology.front(), topology.back()));
+	for (size_t r = 0; r < ROWS; ++r) {
+		for (size_t i = 0; i < topology.front(); ++i) {
+			samples[r].input[i] = float((r*13 + i*7) % 17)/17.f;
+		}
+	}
+	QuantizedPerceptron qnet;
+	if (!qnet.Quantize(net, samples)) {
+		std::printf("quantization failed\n");
+		return EXIT_FAILURE;
+	}
+
+	Perceptron::Matrix dense(ROWS, topology.front());
+	Perceptron::Matrix padded(ROWS, topology.front(), Perceptron::Matrix::ALIGNED);
+	Perceptron::Matrix single(ROWS, topology.back());
+	QuantizedPerceptron::Workspace ws;
+	for (size_t r = 0; r < ROWS; ++r) {
+		std::copy(samples[r].input.begin(), samples[r].input.end(), dense.RowData(r));
+		std::copy(samples[r].input.begin(), samples[r].input.end(), padded.RowData(r));
+		const Perceptron::Vector &y = qnet.Predict(samples[r].input, ws);
+		std::copy(y.begin(), y.end(), single.RowData(r));
+	}
+	const Perceptron::Matrix fromDense = qnet.PredictBatch(dense, ws);
+	const Perceptron::Matrix fromPadded = qnet.PredictBatch(padded, ws);
+
+	const float paddedDiff = MaxDifference(fromDense, fromPadded);
+	const float singleDiff = MaxDifference(fromDense, single);
+	std::printf("padded rows stride %zu, max difference %g, one by one %g\n", padded.RowStride(), paddedDiff, singleDiff);
+	return ((padded.RowStride() != dense.RowStride()) && (0.f == paddedDiff) && (0.f == singleDiff)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}